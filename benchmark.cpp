@@ -0,0 +1,123 @@
+// benchmark.cpp
+//
+// Frame time statistics and JSON benchmark report
+//
+//////////////////////////////////////////////////////////////////////
+
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+
+#include <algorithm>
+
+#ifdef _WIN32
+#include <io.h>
+#define dup _dup
+#define dup2 _dup2
+#define fdopen _fdopen
+#define fileno _fileno
+#else
+#include <unistd.h>
+#endif
+
+#include "benchmark.h"
+
+// the original standard output after redirectStdoutToStderr
+static FILE *reportStdout = NULL;
+
+
+void summarizeFrameTimes(const std::vector<double> &frameMs, FrameTimeStats *stats)
+{
+	memset(stats, 0, sizeof(*stats));
+	if (frameMs.empty()) return;
+
+	std::vector<double> sorted(frameMs);
+	std::sort(sorted.begin(), sorted.end());
+	size_t n = sorted.size();
+
+	// smallest value with at least p percent of the frames at or below it
+	double *targets[] = { &stats->median, &stats->p95, &stats->p99 };
+	double percents[] = { 50, 95, 99 };
+	for (int i = 0; i < 3; i++) {
+		size_t rank = (size_t)ceil(percents[i] / 100 * n);
+		*targets[i] = sorted[rank > 0 ? rank - 1 : 0];
+	}
+
+	double sum = 0;
+	for (size_t i = 0; i < n; i++) sum += sorted[i];
+	stats->min = sorted[0];
+	stats->max = sorted[n - 1];
+	stats->mean = sum / n;
+}
+
+
+//
+// JSON output
+//
+bool redirectStdoutToStderr()
+{
+	fflush(stdout);
+	int fd = dup(fileno(stdout));
+	if (fd < 0) return false;
+	reportStdout = fdopen(fd, "w");
+	if (!reportStdout) return false;
+	return dup2(fileno(stderr), fileno(stdout)) >= 0;
+}
+
+static void writeString(FILE *fp, const std::string &s)
+{
+	fputc('"', fp);
+	for (size_t i = 0; i < s.size(); i++) {
+		unsigned char c = s[i];
+		if (c == '"' || c == '\\') fprintf(fp, "\\%c", c);
+		else if (c < 0x20) fprintf(fp, "\\u%04x", c);
+		else fputc(c, fp);
+	}
+	fputc('"', fp);
+}
+
+bool writeBenchmarkJson(const char *filename, const BenchmarkReport *report)
+{
+	bool toStdout = !strcmp(filename, "-");
+	FILE *fp = toStdout ? (reportStdout ? reportStdout : stdout) : fopen(filename, "w");
+	if (!fp) {
+		printf("Cannot write %s\n", filename);
+		return false;
+	}
+
+	fprintf(fp, "{\n  \"dataset\": ");
+	writeString(fp, report->dataset);
+	fprintf(fp, ",\n  \"voxel_type\": ");
+	writeString(fp, report->voxelType);
+	fprintf(fp, ",\n  \"dims\": [%d, %d, %d],\n  \"renderer\": ", report->dims[0], report->dims[1], report->dims[2]);
+	writeString(fp, report->renderer);
+	fprintf(fp, ",\n  \"width\": %d,\n  \"height\": %d,\n  \"frames_per_run\": %d,\n  \"camera_path\": ",
+		report->width, report->height, report->frames);
+	writeString(fp, report->path);
+	fprintf(fp, ",\n  \"load_ms\": %.3f,\n  \"runs\": [", report->loadMs);
+
+	for (size_t r = 0; r < report->runs.size(); r++) {
+		const BenchmarkRun &run = report->runs[r];
+		FrameTimeStats stats;
+		summarizeFrameTimes(run.frameMs, &stats);
+		double samplesPerSecond = stats.mean > 0 ? run.samplesPerFrame / (stats.mean / 1000) : 0;
+
+		fprintf(fp, "%s\n    {\n      \"name\": ", r ? "," : "");
+		writeString(fp, run.name);
+		fprintf(fp, ",\n      \"render_mode\": %d,\n", run.mode);
+		if (run.mode == 2) fprintf(fp, "      \"iso_value\": %g,\n", run.isoValue);
+		fprintf(fp, "      \"step_size\": %g,\n", run.stepSize);
+		fprintf(fp, "      \"frame_ms\": { \"min\": %.3f, \"median\": %.3f, \"p95\": %.3f, \"p99\": %.3f, \"max\": %.3f, \"mean\": %.3f },\n",
+			stats.min, stats.median, stats.p95, stats.p99, stats.max, stats.mean);
+		fprintf(fp, "      \"samples_per_ray\": %.2f,\n      \"samples_per_second\": %.0f,\n", run.samplesPerRay, samplesPerSecond);
+		fprintf(fp, "      \"frame_times_ms\": [");
+		for (size_t i = 0; i < run.frameMs.size(); i++) {
+			fprintf(fp, "%s%.3f", i ? ", " : "", run.frameMs[i]);
+		}
+		fprintf(fp, "]\n    }");
+	}
+	fprintf(fp, "\n  ]\n}\n");
+
+	if (toStdout) return fflush(fp) == 0;
+	return fclose(fp) == 0;
+}
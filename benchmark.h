@@ -0,0 +1,57 @@
+// benchmark.h: frame time statistics and the benchmark report
+//
+// A benchmark run renders the same scripted camera path once per
+// configuration (render mode, iso-value, step size). The frame times of a
+// run are summarized by their minimum, median and tail percentiles, which
+// are far more stable across runs than the mean, and all runs are written
+// as one JSON document.
+//
+//////////////////////////////////////////////////////////////////////
+
+#ifndef BENCHMARK_H
+#define BENCHMARK_H
+
+#include <string>
+#include <vector>
+
+struct FrameTimeStats
+{
+	double min, median, p95, p99, max, mean;	// ms
+};
+
+// Nearest-rank percentiles of the frame times (ms).
+void summarizeFrameTimes(const std::vector<double> &frameMs, FrameTimeStats *stats);
+
+struct BenchmarkRun
+{
+	std::string name;
+	int mode;
+	float isoValue;
+	float stepSize;
+	std::vector<double> frameMs;
+	double samplesPerFrame;		// volume samples of all rays, averaged over the counted frames
+	double samplesPerRay;
+};
+
+struct BenchmarkReport
+{
+	std::string dataset;
+	std::string voxelType;
+	int dims[3];
+	std::string renderer;		// GL_RENDERER
+	int width, height;
+	int frames;					// per run
+	std::string path;			// description of the camera path
+	double loadMs;
+	std::vector<BenchmarkRun> runs;
+};
+
+// Keeps standard output for the report and sends everything else printed
+// there (progress, per-run lines, errors) to standard error, so that the
+// JSON of "-bench -" can be piped into a parser.
+bool redirectStdoutToStderr();
+
+// Writes the report as JSON to filename ("-": standard output).
+bool writeBenchmarkJson(const char *filename, const BenchmarkReport *report);
+
+#endif
@@ -0,0 +1,113 @@
+// bluenoise.cpp
+//
+// Void-and-cluster blue noise
+//
+//////////////////////////////////////////////////////////////////////
+
+#include <math.h>
+
+#include <vector>
+
+#include "bluenoise.h"
+
+#define N BLUE_NOISE_SIZE
+
+
+// Gaussian energy of the set pixels, on the torus
+struct EnergyField
+{
+	float kernel[N * N];		// weight by wrapped offset
+	float energy[N * N];
+	unsigned char set[N * N];
+
+	void init()
+	{
+		const float sigma = 1.5f;
+		for (int y = 0; y < N; y++)
+		for (int x = 0; x < N; x++) {
+			int dx = x < N / 2 ? x : x - N;
+			int dy = y < N / 2 ? y : y - N;
+			kernel[y * N + x] = expf(-(dx * dx + dy * dy) / (2 * sigma * sigma));
+		}
+		for (int i = 0; i < N * N; i++) {
+			energy[i] = 0;
+			set[i] = 0;
+		}
+	}
+
+	void toggle(int pixel)
+	{
+		float sign = set[pixel] ? -1.0f : 1.0f;
+		set[pixel] ^= 1;
+		int px = pixel % N, py = pixel / N;
+		for (int y = 0; y < N; y++)
+		for (int x = 0; x < N; x++) {
+			energy[y * N + x] += sign * kernel[((y - py) & (N - 1)) * N + ((x - px) & (N - 1))];
+		}
+	}
+
+	// set pixel with the highest energy
+	int tightestCluster() const
+	{
+		int best = -1;
+		for (int i = 0; i < N * N; i++) {
+			if (set[i] && (best < 0 || energy[i] > energy[best])) best = i;
+		}
+		return best;
+	}
+
+	// unset pixel with the lowest energy
+	int largestVoid() const
+	{
+		int best = -1;
+		for (int i = 0; i < N * N; i++) {
+			if (!set[i] && (best < 0 || energy[i] < energy[best])) best = i;
+		}
+		return best;
+	}
+};
+
+
+void computeBlueNoise(unsigned short *ranks)
+{
+	std::vector<EnergyField> fields(2);
+	EnergyField &prototype = fields[0];
+	EnergyField &work = fields[1];
+	prototype.init();
+
+	// initial pattern: a tenth of the pixels from a fixed linear congruential sequence
+	unsigned int seed = 1;
+	int ones = 0;
+	while (ones < N * N / 10) {
+		seed = seed * 1664525u + 1013904223u;
+		int pixel = (seed >> 8) % (N * N);
+		if (prototype.set[pixel]) continue;
+		prototype.toggle(pixel);
+		ones++;
+	}
+
+	// spread it: move the tightest cluster into the largest void until stable
+	for (;;) {
+		int cluster = prototype.tightestCluster();
+		prototype.toggle(cluster);
+		int hole = prototype.largestVoid();
+		prototype.toggle(hole);
+		if (hole == cluster) break;
+	}
+
+	// phase 1: ranks below the prototype, removing the tightest clusters
+	work = prototype;
+	for (int rank = ones - 1; rank >= 0; rank--) {
+		int cluster = work.tightestCluster();
+		work.toggle(cluster);
+		ranks[cluster] = (unsigned short)rank;
+	}
+
+	// phases 2 and 3: ranks above it, filling the largest voids
+	work = prototype;
+	for (int rank = ones; rank < N * N; rank++) {
+		int hole = work.largestVoid();
+		work.toggle(hole);
+		ranks[hole] = (unsigned short)rank;
+	}
+}
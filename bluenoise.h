@@ -0,0 +1,23 @@
+// bluenoise.h: blue-noise threshold map for ray start jitter
+//
+// Starting every ray at the same depth makes the sample planes visible as
+// wood-grain rings once the step grows. Offsetting each ray by a fraction of
+// the step turns the rings into noise; taking the fraction from a blue-noise
+// tile instead of white noise keeps that noise at high spatial frequencies,
+// where it is least visible and averages out fastest.
+//
+// The tile is made with Ulichney's void-and-cluster method: pixels are
+// ranked so that every prefix of the ranking is as evenly spread as
+// possible on the torus. The result is deterministic.
+//
+//////////////////////////////////////////////////////////////////////
+
+#ifndef BLUENOISE_H
+#define BLUENOISE_H
+
+#define BLUE_NOISE_SIZE 64
+
+// ranks[BLUE_NOISE_SIZE * BLUE_NOISE_SIZE] receives every rank 0~4095 once.
+void computeBlueNoise(unsigned short *ranks);
+
+#endif
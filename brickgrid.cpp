@@ -0,0 +1,112 @@
+// brickgrid.cpp
+//
+// Min/max brick grid for empty-space skipping
+//
+//////////////////////////////////////////////////////////////////////
+
+#include <thread>
+#include <vector>
+
+#include "brickgrid.h"
+
+
+//
+// Transfer function index (0~255) of a single voxel, as the shader's
+// nearest-neighbour lookup into the 256 entry table would compute it
+//
+template <VoxelType type>
+static inline int voxelIndex(const unsigned char *p, bool swap)
+{
+	if (type == VOXEL_UINT8) return *p;
+	int index = (int)(decodeVoxel<type>(p, swap) * 256);
+	return index < 0 ? 0 : (index > 255 ? 255 : index);
+}
+
+template <VoxelType type>
+static void buildLayers(const unsigned char *data, const VolumeDesc *desc, BrickGrid *grid, int bz0, int bz1)
+{
+	const int w = desc->dims[0], h = desc->dims[1], d = desc->dims[2];
+	const int size = voxelSize(type);
+	const bool swap = needsByteSwap(desc);
+
+	for (int bz = bz0; bz < bz1; bz++)
+	for (int by = 0; by < grid->dims[1]; by++)
+	for (int bx = 0; bx < grid->dims[0]; bx++) {
+		// brick plus one voxel apron, clamped like GL_CLAMP_TO_EDGE
+		int x0 = bx * BRICK_SIZE - 1, x1 = (bx + 1) * BRICK_SIZE;
+		int y0 = by * BRICK_SIZE - 1, y1 = (by + 1) * BRICK_SIZE;
+		int z0 = bz * BRICK_SIZE - 1, z1 = (bz + 1) * BRICK_SIZE;
+		if (x0 < 0) x0 = 0;
+		if (y0 < 0) y0 = 0;
+		if (z0 < 0) z0 = 0;
+		if (x1 > w - 1) x1 = w - 1;
+		if (y1 > h - 1) y1 = h - 1;
+		if (z1 > d - 1) z1 = d - 1;
+
+		int lo = 255, hi = 0;
+		for (int z = z0; z <= z1; z++)
+		for (int y = y0; y <= y1; y++) {
+			const unsigned char *row = data + (((size_t)z * h + y) * w) * size;
+			for (int x = x0; x <= x1; x++) {
+				int index = voxelIndex<type>(row + (size_t)x * size, swap);
+				if (index < lo) lo = index;
+				if (index > hi) hi = index;
+			}
+		}
+
+		size_t brick = ((size_t)bz * grid->dims[1] + by) * grid->dims[0] + bx;
+		grid->minMax[brick * 2 + 0] = (unsigned char)lo;
+		grid->minMax[brick * 2 + 1] = (unsigned char)hi;
+	}
+}
+
+void buildBrickGrid(const unsigned char *data, const VolumeDesc *desc, BrickGrid *grid)
+{
+	for (int i = 0; i < 3; i++) {
+		grid->dims[i] = (desc->dims[i] + BRICK_SIZE - 1) / BRICK_SIZE;
+	}
+	grid->minMax.resize((size_t)grid->dims[0] * grid->dims[1] * grid->dims[2] * 2);
+
+	void (*build)(const unsigned char *, const VolumeDesc *, BrickGrid *, int, int);
+	switch (desc->type) {
+		case VOXEL_UINT16: build = buildLayers<VOXEL_UINT16>; break;
+		case VOXEL_INT16: build = buildLayers<VOXEL_INT16>; break;
+		case VOXEL_FLOAT32: build = buildLayers<VOXEL_FLOAT32>; break;
+		default: build = buildLayers<VOXEL_UINT8>; break;
+	}
+
+	int threads = (int)std::thread::hardware_concurrency();
+	if (threads > grid->dims[2]) threads = grid->dims[2];
+	if (threads < 1) threads = 1;
+
+	std::vector<std::thread> workers;
+	for (int t = 0; t < threads; t++) {
+		int bz0 = grid->dims[2] * t / threads;
+		int bz1 = grid->dims[2] * (t + 1) / threads;
+		workers.push_back(std::thread(build, data, desc, grid, bz0, bz1));
+	}
+	for (int t = 0; t < threads; t++) {
+		workers[t].join();
+	}
+}
+
+int classifyBricks(const BrickGrid *grid, const float *transferFunction, unsigned char *occupancy)
+{
+	// visible[i] = number of entries below i with non-zero opacity
+	int visible[257];
+	visible[0] = 0;
+	for (int i = 0; i < 256; i++) {
+		visible[i + 1] = visible[i] + (transferFunction[i * 4 + 3] > 0 ? 1 : 0);
+	}
+
+	int count = 0;
+	size_t bricks = grid->minMax.size() / 2;
+	for (size_t i = 0; i < bricks; i++) {
+		int lo = grid->minMax[i * 2 + 0];
+		int hi = grid->minMax[i * 2 + 1];
+		bool occupied = visible[hi + 1] - visible[lo] > 0;
+		occupancy[i] = occupied ? 255 : 0;
+		count += occupied;
+	}
+	return count;
+}
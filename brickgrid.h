@@ -0,0 +1,36 @@
+// brickgrid.h: coarse min/max grid over a volume
+//
+// The volume is divided into BRICK_SIZE^3 voxel bricks and the smallest and
+// largest transfer function index reachable inside every brick is stored.
+// The range includes a one voxel apron, since trilinear samples near a brick
+// face mix in the neighbouring voxels. The grid does not depend on the
+// transfer function, so it is built once per volume; classifying the bricks
+// against a transfer function afterwards is cheap.
+//
+//////////////////////////////////////////////////////////////////////
+
+#ifndef BRICKGRID_H
+#define BRICKGRID_H
+
+#include <vector>
+
+#include "volumefile.h"
+
+#define BRICK_SIZE 8
+
+struct BrickGrid
+{
+	int dims[3];						// number of bricks along x, y, z
+	std::vector<unsigned char> minMax;	// min, max transfer function index per brick
+};
+
+// Builds the grid from the raw voxels of a volume (byte order and int16 bias
+// as described by desc), splitting the brick layers across threads.
+void buildBrickGrid(const unsigned char *data, const VolumeDesc *desc, BrickGrid *grid);
+
+// occupancy[brick] = 255 if any transfer function entry in the brick's range
+// has non-zero opacity, 0 if the whole brick is transparent.
+// Returns the number of non-empty bricks.
+int classifyBricks(const BrickGrid *grid, const float *transferFunction, unsigned char *occupancy);
+
+#endif
@@ -0,0 +1,564 @@
+// compressedvolume.cpp
+//
+// Brick-wise compression, the .cvol converter and the parallel loader
+//
+//////////////////////////////////////////////////////////////////////
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+#include "compressedvolume.h"
+#include "lzcodec.h"
+
+#define COMPRESSED_VERSION 1
+#define COMPRESSED_BYTE_ORDER 0x01020304u
+#define BRICK_STORED 1						// brick flag: the voxels as they are, not compressed
+
+struct CompressedHeader
+{
+	char magic[8];							// "CVOLUME"
+	unsigned int version;
+	unsigned int byteOrder;					// COMPRESSED_BYTE_ORDER as the writing host stores it
+	int dims[3];
+	float spacing[3];
+	int type;
+	int filter;
+	int brickSize;
+	unsigned int brickCount;
+	unsigned long long indexOffset;			// the BrickEntry table, after the bricks
+};
+
+struct BrickEntry
+{
+	unsigned long long offset;
+	unsigned int size;
+	unsigned int flags;
+};
+
+
+bool parseCompressionFilter(const char *name, CompressionFilter *filter)
+{
+	if (strcmp(name, "none") == 0) *filter = COMPRESSION_FILTER_NONE;
+	else if (strcmp(name, "shuffle") == 0) *filter = COMPRESSION_FILTER_SHUFFLE;
+	else if (strcmp(name, "delta") == 0) *filter = COMPRESSION_FILTER_DELTA;
+	else return false;
+	return true;
+}
+
+const char *compressionFilterName(CompressionFilter filter)
+{
+	switch (filter) {
+		case COMPRESSION_FILTER_NONE: return "none";
+		case COMPRESSION_FILTER_SHUFFLE: return "shuffle";
+		case COMPRESSION_FILTER_DELTA: return "delta";
+	}
+	return "?";
+}
+
+
+//
+// Bricks: extent, extraction and the pre-filters
+//
+struct BrickLayout
+{
+	int bricks[3];							// bricks along x, y, z
+	int brickSize;
+	int voxelSize;
+};
+
+static void brickExtent(const BrickLayout *layout, const int dims[3], unsigned int brick, int origin[3], int extent[3])
+{
+	int b[3] = { (int)(brick % layout->bricks[0]), (int)(brick / layout->bricks[0] % layout->bricks[1]),
+		(int)(brick / layout->bricks[0] / layout->bricks[1]) };
+	for (int i = 0; i < 3; i++) {
+		origin[i] = b[i] * layout->brickSize;
+		extent[i] = dims[i] - origin[i] < layout->brickSize ? dims[i] - origin[i] : layout->brickSize;
+	}
+}
+
+template <typename Word>
+static void deltaRows(Word *words, size_t rowLength, size_t rows)
+{
+	for (size_t r = 0; r < rows; r++, words += rowLength) {
+		for (size_t i = rowLength - 1; i > 0; i--) words[i] = (Word)(words[i] - words[i - 1]);
+	}
+}
+
+template <typename Word>
+static void undeltaRows(Word *words, size_t rowLength, size_t rows)
+{
+	for (size_t r = 0; r < rows; r++, words += rowLength) {
+		for (size_t i = 1; i < rowLength; i++) words[i] = (Word)(words[i] + words[i - 1]);
+	}
+}
+
+// byte planes of count voxels of Size bytes, and back
+template <int Size>
+static void shuffleBytes(const unsigned char *voxels, size_t count, unsigned char *planes)
+{
+	for (size_t i = 0; i < count; i++) {
+		for (int plane = 0; plane < Size; plane++) planes[plane * count + i] = voxels[i * Size + plane];
+	}
+}
+
+template <int Size>
+static void unshuffleBytes(const unsigned char *planes, size_t count, unsigned char *voxels)
+{
+	for (size_t i = 0; i < count; i++) {
+		for (int plane = 0; plane < Size; plane++) voxels[i * Size + plane] = planes[plane * count + i];
+	}
+}
+
+// brick holds extent[0] * extent[1] * extent[2] voxels; result may not be brick
+static void applyFilter(CompressionFilter filter, int voxelSize, const int extent[3], unsigned char *brick, unsigned char *result)
+{
+	size_t count = (size_t)extent[0] * extent[1] * extent[2];
+	if (filter == COMPRESSION_FILTER_DELTA) {
+		size_t rows = (size_t)extent[1] * extent[2];
+		if (voxelSize == 1) deltaRows((unsigned char *)brick, extent[0], rows);
+		else if (voxelSize == 2) deltaRows((unsigned short *)brick, extent[0], rows);
+		else deltaRows((unsigned int *)brick, extent[0], rows);
+	}
+	if (filter == COMPRESSION_FILTER_NONE || voxelSize == 1) {
+		memcpy(result, brick, count * voxelSize);
+		return;
+	}
+	if (voxelSize == 2) shuffleBytes<2>(brick, count, result);
+	else shuffleBytes<4>(brick, count, result);
+}
+
+static void removeFilter(CompressionFilter filter, int voxelSize, const int extent[3], const unsigned char *filtered, unsigned char *brick)
+{
+	size_t count = (size_t)extent[0] * extent[1] * extent[2];
+	if (filter == COMPRESSION_FILTER_NONE || voxelSize == 1) {
+		memcpy(brick, filtered, count * voxelSize);
+	}
+	else if (voxelSize == 2) {
+		unshuffleBytes<2>(filtered, count, brick);
+	}
+	else {
+		unshuffleBytes<4>(filtered, count, brick);
+	}
+	if (filter == COMPRESSION_FILTER_DELTA) {
+		size_t rows = (size_t)extent[1] * extent[2];
+		if (voxelSize == 1) undeltaRows((unsigned char *)brick, extent[0], rows);
+		else if (voxelSize == 2) undeltaRows((unsigned short *)brick, extent[0], rows);
+		else undeltaRows((unsigned int *)brick, extent[0], rows);
+	}
+}
+
+
+//
+// Reading the header
+//
+static const char *checkHeader(const CompressedHeader *header)
+{
+	if (memcmp(header->magic, "CVOLUME", 8) != 0) return "not a compressed volume";
+	if (header->version != COMPRESSED_VERSION) return "written by another version";
+	if (header->byteOrder != COMPRESSED_BYTE_ORDER) return "written on a machine of the other byte order";
+	if (header->dims[0] <= 0 || header->dims[1] <= 0 || header->dims[2] <= 0 || header->type < VOXEL_UINT8 ||
+		header->type > VOXEL_FLOAT32 || header->filter < COMPRESSION_FILTER_NONE || header->filter > COMPRESSION_FILTER_DELTA ||
+		header->brickSize <= 0) {
+		return "invalid header";
+	}
+	unsigned long long bricks = 1;
+	for (int i = 0; i < 3; i++) bricks *= (header->dims[i] + header->brickSize - 1) / header->brickSize;
+	if (bricks != header->brickCount) return "invalid header";
+	return NULL;
+}
+
+bool readCompressedVolumeDesc(const char *filename, VolumeDesc *desc)
+{
+	CompressedHeader header;
+	FILE *f = fopen(filename, "rb");
+	bool read = f != NULL && fread(&header, sizeof(header), 1, f) == 1;
+	if (f != NULL) fclose(f);
+	const char *reason = read ? checkHeader(&header) : "truncated";
+	if (reason) {
+		printf("Cannot read %s: %s\n", filename, reason);
+		return false;
+	}
+
+	memcpy(desc->dims, header.dims, sizeof(desc->dims));
+	memcpy(desc->spacing, header.spacing, sizeof(desc->spacing));
+	desc->type = (VoxelType)header.type;
+	desc->bigEndian = hostIsBigEndian();
+	desc->dataOffset = 0;
+	desc->compressed = true;
+	return true;
+}
+
+
+//
+// Decompression: the threads take the bricks in index order
+//
+struct DecompressJob
+{
+	const unsigned char *file;
+	size_t fileBytes;
+	const CompressedHeader *header;
+	const BrickEntry *index;
+	BrickLayout layout;
+	unsigned char *voxels;					// NULL: compare the bricks with reference instead
+	const unsigned char *reference;			// in the byte order of the source, see swapReference
+	bool swapReference;
+	std::atomic<unsigned int> next;
+	std::atomic<bool> failed, differs;
+};
+
+static void decompressBricks(DecompressJob *job)
+{
+	const int *dims = job->header->dims;
+	const int size = job->layout.voxelSize;
+	size_t brickBytes = (size_t)job->layout.brickSize * job->layout.brickSize * job->layout.brickSize * size;
+	std::vector<unsigned char> filtered(brickBytes), brick(brickBytes), expected((size_t)job->layout.brickSize * size);
+
+	for (unsigned int b = job->next++; b < job->header->brickCount && !job->failed; b = job->next++) {
+		int origin[3], extent[3];
+		brickExtent(&job->layout, dims, b, origin, extent);
+		size_t bytes = (size_t)extent[0] * extent[1] * extent[2] * size;
+
+		BrickEntry entry;
+		memcpy(&entry, job->index + b, sizeof(entry));
+		if (entry.offset > job->fileBytes || entry.size > job->fileBytes - entry.offset) {
+			job->failed = true;
+			return;
+		}
+		const unsigned char *data = job->file + entry.offset;
+		if (entry.flags & BRICK_STORED) {
+			if (entry.size != bytes) {
+				job->failed = true;
+				return;
+			}
+			memcpy(brick.data(), data, bytes);
+		}
+		else {
+			if (!lzDecompress(data, entry.size, filtered.data(), bytes)) {
+				job->failed = true;
+				return;
+			}
+			removeFilter((CompressionFilter)job->header->filter, size, extent, filtered.data(), brick.data());
+		}
+
+		size_t rowBytes = (size_t)extent[0] * size;
+		for (int z = 0; z < extent[2]; z++)
+		for (int y = 0; y < extent[1]; y++) {
+			size_t voxel = ((size_t)(origin[2] + z) * dims[1] + origin[1] + y) * dims[0] + origin[0];
+			const unsigned char *row = brick.data() + ((size_t)z * extent[1] + y) * rowBytes;
+			if (job->voxels) {
+				memcpy(job->voxels + voxel * size, row, rowBytes);
+				continue;
+			}
+			memcpy(expected.data(), job->reference + voxel * size, rowBytes);
+			if (job->swapReference) swapVoxels(expected.data(), extent[0], size);
+			if (memcmp(expected.data(), row, rowBytes) != 0) job->differs = true;
+		}
+	}
+}
+
+// Maps the .cvol file of desc and runs job, whose voxels or reference are
+// set, on all threads. Returns false (and prints the reason) if the file is
+// damaged or does not match desc.
+static bool runDecompression(const VolumeDesc *desc, DecompressJob *job, CompressedHeader *header, size_t *fileBytes, int *threads)
+{
+	VolumeSource file;
+	if (!fileSizeOf(desc->dataFile, fileBytes) || *fileBytes < sizeof(CompressedHeader)) {
+		printf("Cannot read %s\n", desc->dataFile);
+		return false;
+	}
+	if (!openVolumeSource(desc->dataFile, 0, *fileBytes, &file)) return false;
+
+	memcpy(header, file.data, sizeof(*header));
+	const char *reason = checkHeader(header);
+	if (reason == NULL && (header->dims[0] != desc->dims[0] || header->dims[1] != desc->dims[1] || header->dims[2] != desc->dims[2] ||
+		header->type != (int)desc->type || desc->bigEndian != hostIsBigEndian())) {
+		reason = "the volume is described differently than in its header";
+	}
+	if (reason == NULL && (header->indexOffset > *fileBytes ||
+		(*fileBytes - header->indexOffset) / sizeof(BrickEntry) < header->brickCount)) {
+		reason = "truncated";
+	}
+	if (reason) {
+		printf("Cannot read %s: %s\n", desc->dataFile, reason);
+		closeVolumeSource(&file);
+		return false;
+	}
+
+	// the index may sit at any offset, so it is copied out of the mapping
+	std::vector<BrickEntry> index(header->brickCount);
+	memcpy(index.data(), file.data + header->indexOffset, index.size() * sizeof(BrickEntry));
+
+	job->file = file.data;
+	job->fileBytes = *fileBytes;
+	job->header = header;
+	job->index = index.data();
+	job->layout.brickSize = header->brickSize;
+	job->layout.voxelSize = voxelSize(desc->type);
+	for (int i = 0; i < 3; i++) job->layout.bricks[i] = (header->dims[i] + header->brickSize - 1) / header->brickSize;
+	job->next = 0;
+	job->failed = false;
+	job->differs = false;
+
+	*threads = (int)std::thread::hardware_concurrency();
+	if (*threads > (int)header->brickCount) *threads = (int)header->brickCount;
+	if (*threads < 1) *threads = 1;
+
+	std::vector<std::thread> workers;
+	for (int t = 0; t < *threads; t++) {
+		workers.push_back(std::thread(decompressBricks, job));
+	}
+	for (int t = 0; t < *threads; t++) {
+		workers[t].join();
+	}
+	closeVolumeSource(&file);
+
+	if (job->failed) {
+		printf("Cannot read %s: a brick is damaged\n", desc->dataFile);
+		return false;
+	}
+	return true;
+}
+
+bool decompressVolume(const VolumeDesc *desc, VolumeSource *src)
+{
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+	size_t size = volumeBytes(desc);
+	unsigned char *voxels = (unsigned char *)malloc(size);
+	if (voxels == NULL) {
+		printf("Cannot allocate %.1f MB for %s\n", size / 1048576.0, desc->dataFile);
+		return false;
+	}
+
+	DecompressJob job;
+	job.voxels = voxels;
+	job.reference = NULL;
+	job.swapReference = false;
+	CompressedHeader header;
+	size_t fileBytes;
+	int threads;
+	if (!runDecompression(desc, &job, &header, &fileBytes, &threads)) {
+		free(voxels);
+		return false;
+	}
+
+	memset(src, 0, sizeof(VolumeSource));
+	src->fd = -1;
+	src->data = voxels;
+	src->size = size;
+	src->mapped = false;
+
+	double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	printf("Decompressed %s: %u bricks (%s filter), %.1f MB to %.1f MB (ratio %.2f) in %.3f s on %d threads, %.2f GB/s of voxels\n",
+		desc->dataFile, header.brickCount, compressionFilterName((CompressionFilter)header.filter), fileBytes / 1048576.0,
+		size / 1048576.0, (double)size / fileBytes, seconds, threads, size / 1e9 / seconds);
+	return true;
+}
+
+
+//
+// Compression: one layer of bricks at a time, compressed on all threads and
+// written in index order
+//
+struct CompressJob
+{
+	const unsigned char *voxels;
+	const int *dims;
+	bool swap;
+	CompressionFilter filter;
+	BrickLayout layout;
+	unsigned int first, count;				// bricks of the layer
+	std::vector<std::vector<unsigned char> > *packed;
+	std::vector<unsigned int> *flags;
+	std::atomic<unsigned int> next;
+};
+
+static void compressBricks(CompressJob *job)
+{
+	const int size = job->layout.voxelSize;
+	size_t brickBytes = (size_t)job->layout.brickSize * job->layout.brickSize * job->layout.brickSize * size;
+	std::vector<unsigned char> brick(brickBytes), filtered(brickBytes);
+
+	for (unsigned int i = job->next++; i < job->count; i = job->next++) {
+		int origin[3], extent[3];
+		brickExtent(&job->layout, job->dims, job->first + i, origin, extent);
+		size_t rowBytes = (size_t)extent[0] * size;
+		size_t bytes = rowBytes * extent[1] * extent[2];
+
+		for (int z = 0; z < extent[2]; z++)
+		for (int y = 0; y < extent[1]; y++) {
+			size_t voxel = ((size_t)(origin[2] + z) * job->dims[1] + origin[1] + y) * job->dims[0] + origin[0];
+			memcpy(brick.data() + ((size_t)z * extent[1] + y) * rowBytes, job->voxels + voxel * size, rowBytes);
+		}
+		if (job->swap) swapVoxels(brick.data(), bytes / size, size);
+
+		std::vector<unsigned char> *packed = &(*job->packed)[i];
+		std::vector<unsigned char> original(brick.begin(), brick.begin() + bytes);
+		applyFilter(job->filter, size, extent, brick.data(), filtered.data());
+		packed->resize(lzCompressBound(bytes));
+		size_t compressed = lzCompress(filtered.data(), bytes, packed->data());
+		if (compressed < bytes) {
+			packed->resize(compressed);
+			(*job->flags)[i] = 0;
+		}
+		else {
+			packed->swap(original);
+			(*job->flags)[i] = BRICK_STORED;
+		}
+	}
+}
+
+// reads the voxels with fread, as the loader did before files were mapped,
+// only for the time it takes; they go through a buffer of a few megabytes
+static bool readRawVolume(const VolumeDesc *desc)
+{
+	FILE *f = fopen(desc->dataFile, "rb");
+	if (f == NULL) return false;
+	std::vector<unsigned char> buffer(4 << 20);
+	bool ok = desc->dataOffset == 0 || fseek(f, (long)desc->dataOffset, SEEK_SET) == 0;
+	for (size_t left = volumeBytes(desc); left > 0 && ok; ) {
+		size_t bytes = left < buffer.size() ? left : buffer.size();
+		ok = fread(buffer.data(), 1, bytes, f) == bytes;
+		left -= bytes;
+	}
+	fclose(f);
+	return ok;
+}
+
+bool writeCompressedVolume(const VolumeDesc *desc, const char *output, CompressionFilter filter)
+{
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+	// a .cvol input is decompressed first, so it can be converted with another filter
+	if (!strcmp(output, desc->dataFile)) {
+		printf("Cannot write %s over the volume it is converted from\n", output);
+		return false;
+	}
+	size_t size = volumeBytes(desc);
+	VolumeSource src;
+	if (!openVolumeData(desc, &src)) return false;
+
+	CompressedHeader header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, "CVOLUME", 8);
+	header.version = COMPRESSED_VERSION;
+	header.byteOrder = COMPRESSED_BYTE_ORDER;
+	memcpy(header.dims, desc->dims, sizeof(header.dims));
+	memcpy(header.spacing, desc->spacing, sizeof(header.spacing));
+	header.type = desc->type;
+	header.filter = filter;
+	header.brickSize = COMPRESSED_BRICK_SIZE;
+
+	CompressJob job;
+	job.voxels = src.data;
+	job.dims = desc->dims;
+	job.swap = needsByteSwap(desc);
+	job.filter = filter;
+	job.layout.brickSize = COMPRESSED_BRICK_SIZE;
+	job.layout.voxelSize = voxelSize(desc->type);
+	for (int i = 0; i < 3; i++) job.layout.bricks[i] = (desc->dims[i] + COMPRESSED_BRICK_SIZE - 1) / COMPRESSED_BRICK_SIZE;
+	unsigned int layerBricks = job.layout.bricks[0] * job.layout.bricks[1];
+	header.brickCount = layerBricks * job.layout.bricks[2];
+
+	FILE *f = fopen(output, "wb");
+	if (f == NULL) {
+		printf("Cannot write %s\n", output);
+		closeVolumeSource(&src);
+		return false;
+	}
+	bool ok = fwrite(&header, sizeof(header), 1, f) == 1;
+
+	int threads = (int)std::thread::hardware_concurrency();
+	if (threads > (int)layerBricks) threads = (int)layerBricks;
+	if (threads < 1) threads = 1;
+
+	std::vector<BrickEntry> index(header.brickCount);
+	std::vector<std::vector<unsigned char> > packed(layerBricks);
+	std::vector<unsigned int> flags(layerBricks);
+	job.packed = &packed;
+	job.flags = &flags;
+	unsigned long long offset = sizeof(header);
+	unsigned int storedBricks = 0;
+	for (int layer = 0; layer < job.layout.bricks[2] && ok; layer++) {
+		job.first = layer * layerBricks;
+		job.count = layerBricks;
+		job.next = 0;
+
+		std::vector<std::thread> workers;
+		for (int t = 0; t < threads; t++) {
+			workers.push_back(std::thread(compressBricks, &job));
+		}
+		for (int t = 0; t < threads; t++) {
+			workers[t].join();
+		}
+
+		for (unsigned int i = 0; i < layerBricks && ok; i++) {
+			BrickEntry *entry = &index[job.first + i];
+			entry->offset = offset;
+			entry->size = (unsigned int)packed[i].size();
+			entry->flags = flags[i];
+			storedBricks += flags[i] & BRICK_STORED;
+			ok = fwrite(packed[i].data(), 1, packed[i].size(), f) == packed[i].size();
+			offset += packed[i].size();
+		}
+	}
+
+	header.indexOffset = offset;
+	ok = ok && fwrite(index.data(), sizeof(BrickEntry), index.size(), f) == index.size();
+	ok = ok && fseek(f, 0, SEEK_SET) == 0 && fwrite(&header, sizeof(header), 1, f) == 1;
+	ok = fclose(f) == 0 && ok;
+	if (!ok) {
+		printf("Cannot write %s\n", output);
+		closeVolumeSource(&src);
+		remove(output);
+		return false;
+	}
+
+	size_t fileBytes = (size_t)offset + index.size() * sizeof(BrickEntry);
+	double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	printf("Compressed %s into %s: %u bricks of %d^3 (%u stored uncompressed), %s filter, %.1f MB to %.1f MB "
+		"(ratio %.2f) in %.3f s on %d threads\n", desc->dataFile, output, header.brickCount, COMPRESSED_BRICK_SIZE,
+		storedBricks, compressionFilterName(filter), size / 1048576.0, fileBytes / 1048576.0, (double)size / fileBytes,
+		seconds, threads);
+
+	// time reading the raw voxels as the loader used to, then decompress the
+	// new file brick by brick as it loads now and compare every brick with
+	// the voxels it came from
+	std::chrono::steady_clock::time_point rawStart = std::chrono::steady_clock::now();
+	if (!desc->compressed && !readRawVolume(desc)) {
+		printf("Cannot read %s back\n", desc->dataFile);
+		closeVolumeSource(&src);
+		return false;
+	}
+	double rawSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - rawStart).count();
+
+	VolumeDesc compressed;
+	CompressedHeader written;
+	size_t writtenBytes;
+	int checkThreads;
+	DecompressJob check;
+	check.voxels = NULL;
+	check.reference = src.data;
+	check.swapReference = job.swap;
+	std::chrono::steady_clock::time_point loadStart = std::chrono::steady_clock::now();
+	bool read = readCompressedVolumeDesc(output, &compressed);
+	snprintf(compressed.dataFile, sizeof(compressed.dataFile), "%s", output);
+	read = read && runDecompression(&compressed, &check, &written, &writtenBytes, &checkThreads);
+	double loadSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - loadStart).count();
+	closeVolumeSource(&src);
+	if (!read) return false;
+	bool same = !check.differs;
+
+	char raw[64] = "";
+	if (!desc->compressed) snprintf(raw, sizeof(raw), "raw fread %.3f s (%.2f GB/s), ", rawSeconds, size / 1e9 / rawSeconds);
+	printf("Load speed: %scompressed %.3f s with the comparison (%.2f GB/s of voxels, %.2f GB/s read); %s\n",
+		raw, loadSeconds, size / 1e9 / loadSeconds, fileBytes / 1e9 / loadSeconds,
+		same ? "the voxels match" : "THE VOXELS DIFFER");
+	return same;
+}
@@ -0,0 +1,54 @@
+// compressedvolume.h: volumes stored as independently compressed bricks
+//
+// A .cvol file holds a volume split into COMPRESSED_BRICK_SIZE^3 voxel
+// bricks, each compressed on its own with the LZ codec, behind a header that
+// describes the volume like a NRRD or MetaImage header would and an index
+// table of the bricks' offsets and sizes. Bricks that do not shrink are
+// stored as they are.
+//
+// Before compression the voxels of a brick can be pre-filtered: the shuffle
+// filter groups the bytes of multi-byte voxels into planes (all low bytes,
+// then all high bytes), so the slowly varying high bytes of CT data form
+// long runs; the delta filter additionally replaces every voxel by its
+// difference to the previous one along x, which turns smooth gradients into
+// runs of small values.
+//
+// The voxels are stored in the byte order of the machine that converted the
+// volume, and the header says which. Loading maps the file and decompresses
+// the bricks on all hardware threads straight into the voxel buffer the
+// upload and the preprocessing read from.
+//
+//////////////////////////////////////////////////////////////////////
+
+#ifndef COMPRESSEDVOLUME_H
+#define COMPRESSEDVOLUME_H
+
+#include "volumefile.h"
+
+#define COMPRESSED_BRICK_SIZE 64
+
+enum CompressionFilter
+{
+	COMPRESSION_FILTER_NONE,
+	COMPRESSION_FILTER_SHUFFLE,		// byte planes of multi-byte voxels
+	COMPRESSION_FILTER_DELTA		// differences along x, then byte planes
+};
+
+bool parseCompressionFilter(const char *name, CompressionFilter *filter);
+const char *compressionFilterName(CompressionFilter filter);
+
+// Fills desc from the header of a .cvol file. Returns false (and prints the
+// reason) if the header is damaged.
+bool readCompressedVolumeDesc(const char *filename, VolumeDesc *desc);
+
+// Converts the voxels described by desc into a .cvol file at output, then
+// decompresses it brick by brick, comparing every brick with the voxels, and
+// prints the compression ratio and the load speed against reading the
+// uncompressed voxels.
+bool writeCompressedVolume(const VolumeDesc *desc, const char *output, CompressionFilter filter);
+
+// Decompresses the .cvol file of desc into a heap buffer in src. Returns
+// false (and prints the reason) if the file is damaged or does not match desc.
+bool decompressVolume(const VolumeDesc *desc, VolumeSource *src);
+
+#endif
@@ -0,0 +1,333 @@
+// cpuraycaster.cpp
+//
+// Multi-threaded software raycaster mirroring volumeRendering.frag
+//
+//////////////////////////////////////////////////////////////////////
+
+#include <stdio.h>
+#include <math.h>
+
+#include <atomic>
+#include <thread>
+#include <vector>
+
+#include "cpuraycaster.h"
+
+#define TILE_SIZE 32
+
+// transfer function opacities are defined for this step size, as in the shader
+#define REFERENCE_STEP 0.001f
+
+
+bool loadCpuVolume(const VolumeDesc *desc, CpuVolume *volume)
+{
+	VolumeSource src;
+	if (!openVolumeData(desc, &src)) return false;
+
+	size_t count = (size_t)desc->dims[0] * desc->dims[1] * desc->dims[2];
+	bool swap = needsByteSwap(desc);
+	for (int i = 0; i < 3; i++) volume->dims[i] = desc->dims[i];
+	volume->voxels.resize(count);
+
+	// same normalization as the R8/R16/R16F texture formats
+	for (size_t i = 0; i < count; i++) {
+		volume->voxels[i] = decodeVoxel(desc->type, src.data + i * voxelSize(desc->type), swap);
+	}
+
+	closeVolumeSource(&src);
+	return true;
+}
+
+
+//
+// Texture lookups as GL does them
+//
+
+// trilinear with GL_CLAMP_TO_EDGE, position in the [-1,1]^3 volume box
+static float sampleVolume(const CpuVolume *volume, const float position[3])
+{
+	int i0[3], i1[3];
+	float f[3];
+	for (int a = 0; a < 3; a++) {
+		float u = (position[a] + 1.0f) / 2 * volume->dims[a] - 0.5f;
+		float base = floorf(u);
+		f[a] = u - base;
+		int n = volume->dims[a] - 1;
+		int i = (int)base;
+		i0[a] = i < 0 ? 0 : (i > n ? n : i);
+		i1[a] = i + 1 < 0 ? 0 : (i + 1 > n ? n : i + 1);
+	}
+
+	const float *v = volume->voxels.data();
+	size_t w = volume->dims[0], wh = w * volume->dims[1];
+	size_t y0 = i0[1] * w, y1 = i1[1] * w, z0 = i0[2] * wh, z1 = i1[2] * wh;
+	float c00 = v[z0 + y0 + i0[0]] + (v[z0 + y0 + i1[0]] - v[z0 + y0 + i0[0]]) * f[0];
+	float c10 = v[z0 + y1 + i0[0]] + (v[z0 + y1 + i1[0]] - v[z0 + y1 + i0[0]]) * f[0];
+	float c01 = v[z1 + y0 + i0[0]] + (v[z1 + y0 + i1[0]] - v[z1 + y0 + i0[0]]) * f[0];
+	float c11 = v[z1 + y1 + i0[0]] + (v[z1 + y1 + i1[0]] - v[z1 + y1 + i0[0]]) * f[0];
+	float c0 = c00 + (c10 - c00) * f[1];
+	float c1 = c01 + (c11 - c01) * f[1];
+	return c0 + (c1 - c0) * f[2];
+}
+
+// nearest entry of the 256 entry table
+static const float *lookupTransferFunction(const float *table, float value)
+{
+	int index = (int)floorf(value * 256);
+	index = index < 0 ? 0 : (index > 255 ? 255 : index);
+	return table + index * 4;
+}
+
+
+//
+// One ray
+//
+struct Ray
+{
+	float origin[3];
+	float direction[3];
+};
+
+static inline void pointOnRay(const float entry[3], const float direction[3], float t, float result[3])
+{
+	for (int a = 0; a < 3; a++) result[a] = entry[a] + t * direction[a];
+}
+
+static inline float dot(const float a[3], const float b[3])
+{
+	return a[0] * b[0] + a[1] * b[1] + a[2] * b[2];
+}
+
+static inline float clampf(float v, float lo, float hi)
+{
+	return v < lo ? lo : (v > hi ? hi : v);
+}
+
+// RGBA of one pixel, before blending
+static void castRay(const CpuVolume *volume, const CpuRenderSettings *settings, const float *table, const Ray *ray, float color[4])
+{
+	const float *dir = ray->direction;
+	float dt = settings->stepSize;
+	color[0] = color[1] = color[2] = color[3] = 0;
+
+	// entry and exit of the ray through the [-1,1]^3 volume box
+	float tNear = 0, tFar = 1e30f;
+	for (int a = 0; a < 3; a++) {
+		float d = fabsf(dir[a]) < 1e-6f ? 1e-6f : dir[a];
+		float t0 = (-1.0f - ray->origin[a]) / d;
+		float t1 = (1.0f - ray->origin[a]) / d;
+		tNear = fmaxf(tNear, fminf(t0, t1));
+		tFar = fminf(tFar, fmaxf(t0, t1));
+	}
+	if (tFar <= tNear) return;	// no fragment for this pixel
+
+	float entry[3], position[3];
+	pointOnRay(ray->origin, dir, tNear, entry);
+	int count = (int)((tFar - tNear) / dt) + 1;
+
+	// maximum intensity projection
+	if (settings->mode == 0) {
+		float maxValue = 0;
+		for (int i = 0; i < count; i++) {
+			pointOnRay(entry, dir, (float)i * dt, position);
+			float value = sampleVolume(volume, position);
+			if (maxValue < value) maxValue = value;
+		}
+		color[0] = color[1] = color[2] = maxValue;
+		color[3] = 1;
+	}
+	// alpha compositing
+	else if (settings->mode == 1) {
+		for (int i = 0; i < count; i++) {
+			pointOnRay(entry, dir, (float)i * dt, position);
+			const float *tf = lookupTransferFunction(table, sampleVolume(volume, position));
+			float alpha = 1.0f - powf(1.0f - powf(tf[3], 5), dt / REFERENCE_STEP);
+			for (int c = 0; c < 3; c++) color[c] += (1.0f - color[3]) * alpha * tf[c];
+			color[3] += (1.0f - color[3]) * alpha;
+
+			if (color[3] > 0.95f) break;
+		}
+	}
+	// iso-surface rendering
+	else if (settings->mode == 2) {
+		float iso = settings->isoValue;
+		float previousValue = 0;
+		for (int i = 0; i < count; i++) {
+			pointOnRay(entry, dir, (float)i * dt, position);
+			float value = sampleVolume(volume, position);
+			if (value <= iso) {
+				previousValue = value;
+				continue;
+			}
+
+			// the surface lies between the previous sample and this one: refine
+			// by secant steps kept inside the bracket
+			float below = (float)(i > 0 ? i - 1 : 0) * dt;
+			float above = (float)i * dt;
+			float belowValue = previousValue, aboveValue = value;
+			float hit = above;
+			if (i > 0) {
+				for (int k = 0; k < settings->isoRefinement; k++) {
+					float w = clampf((iso - belowValue) / fmaxf(aboveValue - belowValue, 1e-6f), 0.05f, 0.95f);
+					float t = below + (above - below) * w;
+					pointOnRay(entry, dir, t, position);
+					float v = sampleVolume(volume, position);
+					if (v > iso) {
+						above = t;
+						aboveValue = v;
+					}
+					else {
+						below = t;
+						belowValue = v;
+					}
+				}
+				hit = below + (above - below) * clampf((iso - belowValue) / fmaxf(aboveValue - belowValue, 1e-6f), 0.0f, 1.0f);
+			}
+			pointOnRay(entry, dir, hit, position);
+
+			// normal by central differences, one texel apart
+			float gradient[3];
+			for (int a = 0; a < 3; a++) {
+				float texel = 2.0f / volume->dims[a];
+				float p0[3] = { position[0], position[1], position[2] };
+				float p1[3] = { position[0], position[1], position[2] };
+				p0[a] -= texel;
+				p1[a] += texel;
+				gradient[a] = (sampleVolume(volume, p1) - sampleVolume(volume, p0)) / volume->dims[a];
+			}
+			float length = sqrtf(dot(gradient, gradient));
+			float normal[3];
+			for (int a = 0; a < 3; a++) normal[a] = length > 0 ? -gradient[a] / length : 0;
+
+			// phong lighting
+			float light[3] = { -0.57735027f, -0.57735027f, -0.57735027f };
+			float ln = dot(light, normal);
+			float diffuse = fmaxf(ln, 0.0f);
+			float reflect[3], view[3];
+			for (int a = 0; a < 3; a++) {
+				reflect[a] = 2.0f * ln * normal[a] - light[a];
+				view[a] = -dir[a];
+			}
+			float specular = powf(fmaxf(dot(reflect, view), 0.0f), 10);
+
+			color[0] = diffuse + specular + 0.1f;
+			color[1] = specular + 0.1f;
+			color[2] = specular + 0.1f;
+			color[3] = 1;
+			break;
+		}
+	}
+}
+
+
+//
+// Tiles
+//
+struct Frame
+{
+	const CpuVolume *volume;
+	const CpuRenderSettings *settings;
+	float table[256 * 4];
+	float eye[3], forward[3], right[3], up[3];
+	float tanHalfFovy, aspect;
+	int width, height, tilesX, tiles;
+	unsigned char *rgb;
+	std::atomic<int> nextTile;
+};
+
+static inline unsigned char toByte(float v)
+{
+	v = v < 0 ? 0 : (v > 1 ? 1 : v);
+	return (unsigned char)(v * 255 + 0.5f);
+}
+
+static void renderTiles(Frame *frame)
+{
+	for (int tile = frame->nextTile++; tile < frame->tiles; tile = frame->nextTile++) {
+		int x0 = tile % frame->tilesX * TILE_SIZE, y0 = tile / frame->tilesX * TILE_SIZE;
+		int x1 = x0 + TILE_SIZE < frame->width ? x0 + TILE_SIZE : frame->width;
+		int y1 = y0 + TILE_SIZE < frame->height ? y0 + TILE_SIZE : frame->height;
+
+		for (int y = y0; y < y1; y++)
+		for (int x = x0; x < x1; x++) {
+			// through the pixel centre
+			float sx = (2 * (x + 0.5f) / frame->width - 1) * frame->tanHalfFovy * frame->aspect;
+			float sy = (1 - 2 * (y + 0.5f) / frame->height) * frame->tanHalfFovy;
+			Ray ray;
+			for (int a = 0; a < 3; a++) {
+				ray.origin[a] = frame->eye[a];
+				ray.direction[a] = frame->forward[a] + sx * frame->right[a] + sy * frame->up[a];
+			}
+			float length = sqrtf(dot(ray.direction, ray.direction));
+			for (int a = 0; a < 3; a++) ray.direction[a] /= length;
+
+			float color[4];
+			castRay(frame->volume, frame->settings, frame->table, &ray, color);
+
+			// GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA over the black background
+			unsigned char *pixel = frame->rgb + ((size_t)y * frame->width + x) * 3;
+			for (int c = 0; c < 3; c++) {
+				pixel[c] = toByte(fminf(fmaxf(color[c], 0.0f), 1.0f) * fminf(fmaxf(color[3], 0.0f), 1.0f));
+			}
+		}
+	}
+}
+
+static void normalize(float v[3])
+{
+	float length = sqrtf(dot(v, v));
+	for (int a = 0; a < 3; a++) v[a] /= length;
+}
+
+static void cross(const float a[3], const float b[3], float result[3])
+{
+	result[0] = a[1] * b[2] - a[2] * b[1];
+	result[1] = a[2] * b[0] - a[0] * b[2];
+	result[2] = a[0] * b[1] - a[1] * b[0];
+}
+
+void raycastImage(const CpuVolume *volume, const CpuCamera *camera, const CpuRenderSettings *settings,
+	int width, int height, unsigned char *rgb, int threads)
+{
+	Frame frame;
+	frame.volume = volume;
+	frame.settings = settings;
+	frame.width = width;
+	frame.height = height;
+	frame.rgb = rgb;
+
+	// the transfer function texture stores 8 bits per channel
+	for (int i = 0; i < 256 * 4; i++) {
+		float v = settings->transferFunction[i];
+		frame.table[i] = toByte(v) / 255.0f;
+	}
+
+	// gluLookAt(eye, origin, up) and gluPerspective(fovy, width / height)
+	for (int a = 0; a < 3; a++) {
+		frame.eye[a] = camera->distance * camera->eye[a];
+		frame.forward[a] = -camera->eye[a];
+	}
+	normalize(frame.forward);
+	cross(frame.forward, camera->up, frame.right);
+	normalize(frame.right);
+	cross(frame.right, frame.forward, frame.up);
+	frame.tanHalfFovy = tanf(camera->fovy * 3.14159265f / 360);
+	frame.aspect = (float)width / height;
+
+	frame.tilesX = (width + TILE_SIZE - 1) / TILE_SIZE;
+	frame.tiles = frame.tilesX * ((height + TILE_SIZE - 1) / TILE_SIZE);
+	frame.nextTile = 0;
+
+	if (threads <= 0) threads = (int)std::thread::hardware_concurrency();
+	if (threads > frame.tiles) threads = frame.tiles;
+	if (threads < 1) threads = 1;
+
+	std::vector<std::thread> workers;
+	for (int t = 1; t < threads; t++) {
+		workers.push_back(std::thread(renderTiles, &frame));
+	}
+	renderTiles(&frame);
+	for (size_t t = 0; t < workers.size(); t++) {
+		workers[t].join();
+	}
+}
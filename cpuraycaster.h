@@ -0,0 +1,53 @@
+// cpuraycaster.h: software raycaster for machines without a GPU
+//
+// Renders the same images as volumeRendering.frag (MIP, alpha compositing
+// with opacity correction, iso-surface with Phong shading) for the same
+// camera as drawVolume: looking from eyeDistance * eye towards the origin
+// through a perspective projection with a 60 degree vertical field of view.
+//
+// The image is split into tiles that a pool of threads takes in turn. Every
+// pixel is computed by the same code whatever thread renders it, so the
+// result is bit-for-bit identical for any number of threads.
+//
+//////////////////////////////////////////////////////////////////////
+
+#ifndef CPURAYCASTER_H
+#define CPURAYCASTER_H
+
+#include <vector>
+
+#include "volumefile.h"
+
+// voxels normalized to [0,1] like the GL texture returns them
+struct CpuVolume
+{
+	int dims[3];
+	std::vector<float> voxels;
+};
+
+struct CpuCamera
+{
+	float eye[3];		// unit direction from the volume centre to the eye
+	float up[3];
+	float distance;
+	float fovy;			// degrees
+};
+
+struct CpuRenderSettings
+{
+	int mode;						// 0: MIP, 1: alpha compositing, 2: iso-surface
+	float stepSize;
+	float isoValue;
+	int isoRefinement;				// secant steps refining an iso-surface hit
+	const float *transferFunction;	// 256*4 RGBA
+};
+
+// Reads the voxels described by desc. Returns false (and prints the reason) on failure.
+bool loadCpuVolume(const VolumeDesc *desc, CpuVolume *volume);
+
+// Renders a width x height RGB image, rows top to bottom, as it appears
+// blended over a black background. threads 0: one per hardware thread.
+void raycastImage(const CpuVolume *volume, const CpuCamera *camera, const CpuRenderSettings *settings,
+	int width, int height, unsigned char *rgb, int threads = 0);
+
+#endif
@@ -0,0 +1,250 @@
+// framestats.cpp
+//
+// GPU timer queries, frame time history and the statistics overlay
+//
+//////////////////////////////////////////////////////////////////////
+
+#include <stdio.h>
+#include <string.h>
+
+#include <algorithm>
+#include <vector>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <sys/resource.h>
+#endif
+
+#include "framestats.h"
+
+#include <GL/glut.h>
+
+
+void initFrameStats(FrameStats *stats)
+{
+	glGenQueries(2, stats->queries);
+	stats->pending[0] = stats->pending[1] = false;
+	stats->nextQuery = 0;
+	stats->activeQuery = -1;
+	stats->gpuMs = 0;
+	stats->gpuFresh = false;
+
+	stats->historyCount = stats->historyNext = 0;
+
+	stats->start = stats->secondStart = std::chrono::steady_clock::now();
+	stats->frames = stats->gpuFrames = 0;
+	stats->cpuSum = stats->gpuSum = stats->uploadSum = stats->swapSum = 0;
+	stats->uploadBytesSum = 0;
+	stats->fps = stats->cpuMs = stats->gpuAverageMs = stats->uploadMs = stats->swapMs = 0;
+	stats->uploadBytes = 0;
+	stats->uploadBytesTotal = 0;
+	stats->log = true;
+}
+
+
+//
+// GPU timer queries
+//
+
+// picks up the results that are ready
+static void collectGpuTimes(FrameStats *stats)
+{
+	for (int q = 0; q < 2; q++) {
+		if (!stats->pending[q]) continue;
+
+		GLint available = 0;
+		glGetQueryObjectiv(stats->queries[q], GL_QUERY_RESULT_AVAILABLE, &available);
+		if (!available) continue;
+
+		GLuint64 ns = 0;
+		glGetQueryObjectui64v(stats->queries[q], GL_QUERY_RESULT, &ns);
+		stats->gpuMs = ns / 1e6;
+		stats->pending[q] = false;
+		stats->gpuFresh = true;
+	}
+}
+
+void beginGpuTimer(FrameStats *stats)
+{
+	collectGpuTimes(stats);
+
+	// both queries still in flight: skip this frame rather than wait
+	int q = stats->nextQuery;
+	if (stats->pending[q]) {
+		stats->activeQuery = -1;
+		return;
+	}
+	glBeginQuery(GL_TIME_ELAPSED, stats->queries[q]);
+	stats->activeQuery = q;
+}
+
+void endGpuTimer(FrameStats *stats)
+{
+	int q = stats->activeQuery;
+	if (q < 0) return;
+	glEndQuery(GL_TIME_ELAPSED);
+	stats->pending[q] = true;
+	stats->nextQuery = 1 - q;
+	stats->activeQuery = -1;
+}
+
+
+//
+// History and log
+//
+void recordFrame(FrameStats *stats, double cpuMs, double uploadMs, size_t uploadBytes, double swapMs, const char *label)
+{
+	collectGpuTimes(stats);
+	bool gpuKnown = stats->gpuFresh;
+	stats->gpuFresh = false;
+
+	stats->history[stats->historyNext] = gpuKnown ? stats->gpuMs : cpuMs;
+	stats->historyNext = (stats->historyNext + 1) % FRAME_HISTORY;
+	if (stats->historyCount < FRAME_HISTORY) stats->historyCount++;
+
+	stats->frames++;
+	stats->cpuSum += cpuMs;
+	stats->uploadSum += uploadMs;
+	stats->uploadBytesSum += uploadBytes;
+	stats->uploadBytesTotal += uploadBytes;
+	stats->swapSum += swapMs;
+	if (gpuKnown) {
+		stats->gpuFrames++;
+		stats->gpuSum += stats->gpuMs;
+	}
+
+	std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+	double seconds = std::chrono::duration<double>(now - stats->secondStart).count();
+	if (seconds < 1) return;
+
+	stats->fps = stats->frames / seconds;
+	stats->cpuMs = stats->cpuSum / stats->frames;
+	stats->gpuAverageMs = stats->gpuFrames ? stats->gpuSum / stats->gpuFrames : 0;
+	stats->uploadMs = stats->uploadSum / stats->frames;
+	stats->uploadBytes = (double)stats->uploadBytesSum / stats->frames;
+	stats->swapMs = stats->swapSum / stats->frames;
+
+	if (stats->log) {
+		printf("frame_stats time=%.1f frames=%d fps=%.2f cpu_ms=%.3f gpu_ms=%.3f gpu_frames=%d tf_upload_ms=%.3f tf_upload_bytes=%.0f tf_upload_total=%zu swap_ms=%.3f %s\n",
+			std::chrono::duration<double>(now - stats->start).count(), stats->frames, stats->fps,
+			stats->cpuMs, stats->gpuAverageMs, stats->gpuFrames, stats->uploadMs, stats->uploadBytes,
+			stats->uploadBytesTotal, stats->swapMs, label);
+		fflush(stdout);
+	}
+
+	stats->secondStart = now;
+	stats->frames = stats->gpuFrames = 0;
+	stats->cpuSum = stats->gpuSum = stats->uploadSum = stats->swapSum = 0;
+	stats->uploadBytesSum = 0;
+}
+
+double processCpuSeconds()
+{
+#ifdef _WIN32
+	FILETIME creation, exit, kernel, user;
+	if (!GetProcessTimes(GetCurrentProcess(), &creation, &exit, &kernel, &user)) return 0;
+	ULARGE_INTEGER k, u;
+	k.LowPart = kernel.dwLowDateTime;
+	k.HighPart = kernel.dwHighDateTime;
+	u.LowPart = user.dwLowDateTime;
+	u.HighPart = user.dwHighDateTime;
+	return (k.QuadPart + u.QuadPart) * 1e-7;
+#else
+	struct rusage usage;
+	if (getrusage(RUSAGE_SELF, &usage) != 0) return 0;
+	return usage.ru_utime.tv_sec + usage.ru_stime.tv_sec + (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) * 1e-6;
+#endif
+}
+
+double frameHistogramBound(int bin)
+{
+	// 4 ms doubling up to 256 ms
+	return bin < FRAME_HISTOGRAM_BINS - 1 ? 4.0 * (1 << bin) : 1e30;
+}
+
+
+//
+// Overlay
+//
+static void drawText(int x, int y, const char *text)
+{
+	glWindowPos2i(x, y);
+	for (const char *c = text; *c; c++) {
+		glutBitmapCharacter(GLUT_BITMAP_8_BY_13, *c);
+	}
+}
+
+void drawFrameStatsOverlay(const FrameStats *stats, int width, int height)
+{
+	int counts[FRAME_HISTOGRAM_BINS] = { 0 };
+	std::vector<double> recent(stats->history, stats->history + stats->historyCount);
+	for (size_t i = 0; i < recent.size(); i++) {
+		int bin = 0;
+		while (recent[i] >= frameHistogramBound(bin)) bin++;
+		counts[bin]++;
+	}
+	std::sort(recent.begin(), recent.end());
+	double median = recent.empty() ? 0 : recent[recent.size() / 2];
+	double p95 = recent.empty() ? 0 : recent[(recent.size() * 95) / 100];
+
+	glUseProgram(0);
+	glDisable(GL_DEPTH_TEST);
+	glMatrixMode(GL_PROJECTION);
+	glPushMatrix();
+	glLoadIdentity();
+	glOrtho(0, width, 0, height, -1, 1);
+	glMatrixMode(GL_MODELVIEW);
+	glPushMatrix();
+	glLoadIdentity();
+
+	// translucent backdrop
+	int top = height - 8, lineHeight = 15;
+	int boxHeight = lineHeight * (4 + FRAME_HISTOGRAM_BINS) + 8;
+	glColor4f(0, 0, 0, 0.6f);
+	glBegin(GL_QUADS);
+	glVertex2i(4, top + 4);
+	glVertex2i(4 + 330, top + 4);
+	glVertex2i(4 + 330, top - boxHeight);
+	glVertex2i(4, top - boxHeight);
+	glEnd();
+
+	char line[128];
+	int y = top - lineHeight + 2;
+	glColor3f(1, 1, 0);
+	sprintf(line, "%.1f fps  cpu %.2f ms  gpu %.2f ms", stats->fps, stats->cpuMs, stats->gpuAverageMs);
+	drawText(10, y, line);
+	y -= lineHeight;
+	sprintf(line, "tf upload %.3f ms %.0f B  swap %.3f ms", stats->uploadMs, stats->uploadBytes, stats->swapMs);
+	drawText(10, y, line);
+	y -= lineHeight;
+	sprintf(line, "last %d frames: median %.2f  p95 %.2f ms", stats->historyCount, median, p95);
+	drawText(10, y, line);
+	y -= lineHeight;
+
+	// histogram, one bar per bin
+	for (int bin = 0; bin < FRAME_HISTOGRAM_BINS; bin++) {
+		y -= lineHeight;
+		if (bin < FRAME_HISTOGRAM_BINS - 1) sprintf(line, "< %3.0f ms %4d", frameHistogramBound(bin), counts[bin]);
+		else sprintf(line, ">=%3.0f ms %4d", frameHistogramBound(bin - 1), counts[bin]);
+		glColor3f(1, 1, 1);
+		drawText(10, y, line);
+
+		int bar = stats->historyCount ? counts[bin] * 200 / stats->historyCount : 0;
+		glColor3f(0.3f, 0.8f, 0.3f);
+		glBegin(GL_QUADS);
+		glVertex2i(120, y);
+		glVertex2i(120 + bar, y);
+		glVertex2i(120 + bar, y + 10);
+		glVertex2i(120, y + 10);
+		glEnd();
+	}
+
+	glMatrixMode(GL_PROJECTION);
+	glPopMatrix();
+	glMatrixMode(GL_MODELVIEW);
+	glPopMatrix();
+	glEnable(GL_DEPTH_TEST);
+}
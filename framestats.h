@@ -0,0 +1,78 @@
+// framestats.h: per-frame timing of the interactive renderer
+//
+// The GPU time of the raycasting draw is measured with GL_TIME_ELAPSED
+// queries. Two queries alternate and a result is only read once it is
+// available, so measuring never waits for the GPU; if both are still in
+// flight the frame simply goes unmeasured. CPU times of the transfer
+// function upload and the buffer swap are taken around the calls, and the
+// bytes the upload sent are counted.
+//
+// The last FRAME_HISTORY frames are kept for a histogram and percentiles,
+// drawn as a text overlay, and every second a key=value log line with the
+// averages of that second is printed.
+//
+//////////////////////////////////////////////////////////////////////
+
+#ifndef FRAMESTATS_H
+#define FRAMESTATS_H
+
+#include <GL/glew.h>
+
+#include <stddef.h>
+
+#include <chrono>
+
+#define FRAME_HISTORY 256
+#define FRAME_HISTOGRAM_BINS 8
+
+struct FrameStats
+{
+	// GPU timer queries
+	GLuint queries[2];
+	bool pending[2];
+	int nextQuery;
+	int activeQuery;			// -1: this frame is not measured
+	double gpuMs;				// latest GPU time that came back
+	bool gpuFresh;				// gpuMs came back since the last recorded frame
+
+	// rolling history: GPU time of the frame where known, CPU time otherwise
+	double history[FRAME_HISTORY];
+	int historyCount, historyNext;
+
+	// sums over the current second
+	std::chrono::steady_clock::time_point start, secondStart;
+	int frames, gpuFrames;
+	double cpuSum, gpuSum, uploadSum, swapSum;
+	size_t uploadBytesSum;
+
+	// averages of the last complete second, shown by the overlay
+	double fps, cpuMs, gpuAverageMs, uploadMs, swapMs;
+	double uploadBytes;			// per frame
+	size_t uploadBytesTotal;	// since initFrameStats
+
+	bool log;					// print a line per second
+};
+
+void initFrameStats(FrameStats *stats);
+
+// Around the draw calls to measure on the GPU.
+void beginGpuTimer(FrameStats *stats);
+void endGpuTimer(FrameStats *stats);
+
+// Adds a finished frame: its CPU time from start of drawing to after the
+// swap, the parts spent uploading transfer function data and swapping, and
+// the bytes uploaded. label is appended to the log line (e.g. "mode=1 step=0.001").
+void recordFrame(FrameStats *stats, double cpuMs, double uploadMs, size_t uploadBytes, double swapMs, const char *label);
+
+// User plus system CPU time of the whole process so far, all threads.
+double processCpuSeconds();
+
+// Upper bound (ms) of histogram bin i; the last bin is open.
+double frameHistogramBound(int bin);
+
+// Draws the statistics and the histogram of the recent frame times in the
+// top left corner of a width x height window. Uses the fixed pipeline and
+// GLUT bitmap fonts; restores the matrices and the depth test.
+void drawFrameStatsOverlay(const FrameStats *stats, int width, int height);
+
+#endif
@@ -0,0 +1,201 @@
+// gradient.cpp
+//
+// Multithreaded gradient volume computation and packing
+//
+//////////////////////////////////////////////////////////////////////
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <thread>
+
+#include "gradient.h"
+
+
+bool parseGradientFilter(const char *name, GradientFilter *filter)
+{
+	if (strcmp(name, "central") == 0) *filter = GRADIENT_CENTRAL;
+	else if (strcmp(name, "sobel") == 0) *filter = GRADIENT_SOBEL;
+	else return false;
+	return true;
+}
+
+bool parseGradientFormat(const char *name, GradientFormat *format)
+{
+	if (strcmp(name, "rgba8") == 0) *format = GRADIENT_RGBA8;
+	else if (strcmp(name, "rgb10a2") == 0) *format = GRADIENT_RGB10_A2;
+	else return false;
+	return true;
+}
+
+const char *gradientFilterName(GradientFilter filter)
+{
+	return filter == GRADIENT_SOBEL ? "sobel" : "central";
+}
+
+const char *gradientFormatName(GradientFormat format)
+{
+	return format == GRADIENT_RGB10_A2 ? "rgb10a2" : "rgba8";
+}
+
+void gradientTextureFormat(GradientFormat format, GLenum *internalFormat, GLenum *pixelFormat, GLenum *pixelType)
+{
+	*pixelFormat = GL_RGBA;
+	if (format == GRADIENT_RGB10_A2) {
+		*internalFormat = GL_RGB10_A2;
+		*pixelType = GL_UNSIGNED_INT_2_10_10_10_REV;
+	}
+	else {
+		*internalFormat = GL_RGBA8;
+		*pixelType = GL_UNSIGNED_BYTE;	// bytes R, G, B, A in memory order
+	}
+}
+
+
+//
+// Gradient of the voxels, normalized to [0,1] like the texture the shader samples
+//
+template <VoxelType type>
+struct GradientKernel
+{
+	const unsigned char *data;
+	int w, h, d;
+	int size;
+	bool swap;
+	GradientFilter filter;
+
+	// clamped like GL_CLAMP_TO_EDGE
+	float at(int x, int y, int z) const
+	{
+		x = x < 0 ? 0 : (x >= w ? w - 1 : x);
+		y = y < 0 ? 0 : (y >= h ? h - 1 : y);
+		z = z < 0 ? 0 : (z >= d ? d - 1 : z);
+		return decodeVoxel<type>(data + (((size_t)z * h + y) * w + x) * size, swap);
+	}
+
+	void gradient(int x, int y, int z, float g[3]) const
+	{
+		if (filter == GRADIENT_CENTRAL) {
+			g[0] = at(x + 1, y, z) - at(x - 1, y, z);
+			g[1] = at(x, y + 1, z) - at(x, y - 1, z);
+			g[2] = at(x, y, z + 1) - at(x, y, z - 1);
+		}
+		else {
+			// derivative [-1 0 1] along the axis, smoothing [1 2 1] across it,
+			// normalized to the same scale as the central difference
+			g[0] = g[1] = g[2] = 0;
+			for (int k = -1; k <= 1; k++)
+			for (int j = -1; j <= 1; j++) {
+				float weight = (float)((2 - abs(j)) * (2 - abs(k))) / 16;
+				g[0] += weight * (at(x + 1, y + j, z + k) - at(x - 1, y + j, z + k));
+				g[1] += weight * (at(x + j, y + 1, z + k) - at(x + j, y - 1, z + k));
+				g[2] += weight * (at(x + j, y + k, z + 1) - at(x + j, y + k, z - 1));
+			}
+		}
+		// the shader divides by the texture size along each axis
+		g[0] /= w;
+		g[1] /= h;
+		g[2] /= d;
+	}
+};
+
+template <VoxelType type>
+static void largestMagnitude(const GradientKernel<type> *kernel, int z0, int z1, float *result)
+{
+	float largest = 0;
+	for (int z = z0; z < z1; z++)
+	for (int y = 0; y < kernel->h; y++)
+	for (int x = 0; x < kernel->w; x++) {
+		float g[3];
+		kernel->gradient(x, y, z, g);
+		largest = std::max(largest, g[0] * g[0] + g[1] * g[1] + g[2] * g[2]);
+	}
+	*result = sqrtf(largest);
+}
+
+template <VoxelType type>
+static void packGradients(const GradientKernel<type> *kernel, GradientFormat format, float largest,
+	int z0, int z1, unsigned int *texels)
+{
+	for (int z = z0; z < z1; z++)
+	for (int y = 0; y < kernel->h; y++)
+	for (int x = 0; x < kernel->w; x++) {
+		float g[3];
+		kernel->gradient(x, y, z, g);
+		float magnitude = sqrtf(g[0] * g[0] + g[1] * g[1] + g[2] * g[2]);
+		float n[3] = { 0, 0, 0 };
+		if (magnitude > 0) {
+			for (int c = 0; c < 3; c++) n[c] = g[c] / magnitude;
+		}
+		float a = largest > 0 ? magnitude / largest : 0;
+
+		unsigned int texel;
+		if (format == GRADIENT_RGB10_A2) {
+			unsigned int r = (unsigned int)((n[0] * 0.5f + 0.5f) * 1023 + 0.5f);
+			unsigned int gg = (unsigned int)((n[1] * 0.5f + 0.5f) * 1023 + 0.5f);
+			unsigned int b = (unsigned int)((n[2] * 0.5f + 0.5f) * 1023 + 0.5f);
+			unsigned int alpha = (unsigned int)(a * 3 + 0.5f);
+			texel = r | (gg << 10) | (b << 20) | (alpha << 30);
+		}
+		else {
+			unsigned char bytes[4] = {
+				(unsigned char)((n[0] * 0.5f + 0.5f) * 255 + 0.5f),
+				(unsigned char)((n[1] * 0.5f + 0.5f) * 255 + 0.5f),
+				(unsigned char)((n[2] * 0.5f + 0.5f) * 255 + 0.5f),
+				(unsigned char)(a * 255 + 0.5f)
+			};
+			memcpy(&texel, bytes, 4);
+		}
+		texels[((size_t)z * kernel->h + y) * kernel->w + x] = texel;
+	}
+}
+
+template <VoxelType type>
+static float computeTyped(const unsigned char *data, const VolumeDesc *desc, GradientFilter filter,
+	GradientFormat format, unsigned int *texels)
+{
+	GradientKernel<type> kernel;
+	kernel.data = data;
+	kernel.w = desc->dims[0];
+	kernel.h = desc->dims[1];
+	kernel.d = desc->dims[2];
+	kernel.size = voxelSize(type);
+	kernel.swap = needsByteSwap(desc);
+	kernel.filter = filter;
+
+	int threads = (int)std::thread::hardware_concurrency();
+	if (threads > kernel.d) threads = kernel.d;
+	if (threads < 1) threads = 1;
+
+	// the magnitudes are packed relative to the largest, so it is found first
+	std::vector<float> largest(threads);
+	std::vector<std::thread> workers;
+	for (int t = 0; t < threads; t++) {
+		int z0 = kernel.d * t / threads, z1 = kernel.d * (t + 1) / threads;
+		workers.push_back(std::thread(largestMagnitude<type>, &kernel, z0, z1, &largest[t]));
+	}
+	for (int t = 0; t < threads; t++) workers[t].join();
+	float volumeLargest = *std::max_element(largest.begin(), largest.end());
+
+	workers.clear();
+	for (int t = 0; t < threads; t++) {
+		int z0 = kernel.d * t / threads, z1 = kernel.d * (t + 1) / threads;
+		workers.push_back(std::thread(packGradients<type>, &kernel, format, volumeLargest, z0, z1, texels));
+	}
+	for (int t = 0; t < threads; t++) workers[t].join();
+	return volumeLargest;
+}
+
+float computeGradientVolume(const unsigned char *data, const VolumeDesc *desc, GradientFilter filter,
+	GradientFormat format, std::vector<unsigned int> *texels)
+{
+	texels->resize((size_t)desc->dims[0] * desc->dims[1] * desc->dims[2]);
+	switch (desc->type) {
+		case VOXEL_UINT16: return computeTyped<VOXEL_UINT16>(data, desc, filter, format, texels->data());
+		case VOXEL_INT16: return computeTyped<VOXEL_INT16>(data, desc, filter, format, texels->data());
+		case VOXEL_FLOAT32: return computeTyped<VOXEL_FLOAT32>(data, desc, filter, format, texels->data());
+		default: return computeTyped<VOXEL_UINT8>(data, desc, filter, format, texels->data());
+	}
+}
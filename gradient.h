@@ -0,0 +1,51 @@
+// gradient.h: precomputed gradient volume for shading
+//
+// Shading a sample on the fly needs six extra volume fetches for central
+// differences. Instead the gradient of every voxel is computed once after
+// loading, on all hardware threads, and stored next to the volume as a
+// packed texture: the normalized direction in RGB (mapped from [-1,1] to
+// [0,1]) and the magnitude relative to the largest one in the volume in A.
+// The shader then shades with a single filtered fetch.
+//
+// Gradients are taken in the same units as the shader's on-the-fly central
+// differences (value difference divided by the volume size along the axis),
+// so both sources give the same directions and magnitudes.
+//
+//////////////////////////////////////////////////////////////////////
+
+#ifndef GRADIENT_H
+#define GRADIENT_H
+
+#include <GL/glew.h>
+
+#include <vector>
+
+#include "volumefile.h"
+
+enum GradientFilter
+{
+	GRADIENT_CENTRAL,		// central differences of the neighbours
+	GRADIENT_SOBEL			// 3x3x3 Sobel operator, smooths noisy data
+};
+
+enum GradientFormat
+{
+	GRADIENT_RGBA8,			// 8-bit direction components and magnitude
+	GRADIENT_RGB10_A2		// 10-bit direction, magnitude in 4 steps
+};
+
+bool parseGradientFilter(const char *name, GradientFilter *filter);
+bool parseGradientFormat(const char *name, GradientFormat *format);
+const char *gradientFilterName(GradientFilter filter);
+const char *gradientFormatName(GradientFormat format);
+
+// Texture format and pixel format/type of the packed texels.
+void gradientTextureFormat(GradientFormat format, GLenum *internalFormat, GLenum *pixelFormat, GLenum *pixelType);
+
+// Computes the packed gradients of the raw voxels of a volume (byte order
+// and int16 bias as described by desc) into texels, one 32-bit texel per
+// voxel. Returns the largest magnitude, which A = 1 stands for.
+float computeGradientVolume(const unsigned char *data, const VolumeDesc *desc, GradientFilter filter,
+	GradientFormat format, std::vector<unsigned int> *texels);
+
+#endif
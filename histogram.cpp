@@ -0,0 +1,240 @@
+// histogram.cpp
+//
+// Multi-threaded voxel histograms with private sub-histograms
+//
+//////////////////////////////////////////////////////////////////////
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <chrono>
+#include <thread>
+#include <vector>
+
+// the AVX2 reduction is compiled for the avx2 target whatever the build
+// flags and chosen at run time, where the compiler supports both
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#define HISTOGRAM_AVX2
+#include <immintrin.h>
+#endif
+
+#include "histogram.h"
+
+// independent counters per thread; consecutive voxels go to different ones
+#define SUB_HISTOGRAMS 4
+
+// below this many voxels per thread, spawning threads costs more than it saves
+#define MIN_VOXELS_PER_THREAD (1 << 20)
+
+
+#ifdef HISTOGRAM_AVX2
+static bool cpuHasAvx2()
+{
+	static const bool avx2 = __builtin_cpu_supports("avx2") != 0;
+	return avx2;
+}
+
+__attribute__((target("avx2")))
+static void addCountsAvx2(uint64_t *dst, const uint64_t *src, int bins)
+{
+	int i = 0;
+	for (; i + 4 <= bins; i += 4) {
+		__m256i a = _mm256_loadu_si256((const __m256i *)(dst + i));
+		__m256i b = _mm256_loadu_si256((const __m256i *)(src + i));
+		_mm256_storeu_si256((__m256i *)(dst + i), _mm256_add_epi64(a, b));
+	}
+	for (; i < bins; i++) {
+		dst[i] += src[i];
+	}
+}
+#endif
+
+static void addCounts(uint64_t *dst, const uint64_t *src, int bins)
+{
+#ifdef HISTOGRAM_AVX2
+	if (cpuHasAvx2()) {
+		addCountsAvx2(dst, src, bins);
+		return;
+	}
+#endif
+	for (int i = 0; i < bins; i++) {
+		dst[i] += src[i];
+	}
+}
+
+//
+// Counting kernel. When bins equals the number of representable values the
+// voxel is its own bin index and the scaling is skipped.
+//
+template <typename T, int bits, bool identity>
+static void countVoxels(const T *v, size_t count, int bins, uint64_t *sub)
+{
+	uint64_t *h0 = sub;
+	uint64_t *h1 = sub + bins;
+	uint64_t *h2 = sub + 2 * bins;
+	uint64_t *h3 = sub + 3 * bins;
+
+#define BIN(x) (identity ? (unsigned int)(x) : ((unsigned int)(x) * (unsigned int)bins) >> bits)
+	size_t i = 0;
+	for (; i + 8 <= count; i += 8) {
+		h0[BIN(v[i + 0])]++;
+		h1[BIN(v[i + 1])]++;
+		h2[BIN(v[i + 2])]++;
+		h3[BIN(v[i + 3])]++;
+		h0[BIN(v[i + 4])]++;
+		h1[BIN(v[i + 5])]++;
+		h2[BIN(v[i + 6])]++;
+		h3[BIN(v[i + 7])]++;
+	}
+	for (; i < count; i++) {
+		h0[BIN(v[i])]++;
+	}
+#undef BIN
+}
+
+static void countFloats(const float *v, size_t count, int bins, uint64_t *sub)
+{
+	for (size_t i = 0; i < count; i++) {
+		int bin = (int)(v[i] * bins);
+		if (bin < 0) bin = 0;
+		if (bin >= bins) bin = bins - 1;
+		sub[(i % SUB_HISTOGRAMS) * bins + bin]++;
+	}
+}
+
+void accumulateHistogram(const void *data, size_t count, int bytesPerVoxel, int bins, uint64_t *counts)
+{
+	std::vector<uint64_t> sub((size_t)SUB_HISTOGRAMS * bins, 0);
+
+	if (bytesPerVoxel == 1) {
+		if (bins == 256) countVoxels<unsigned char, 8, true>((const unsigned char *)data, count, bins, sub.data());
+		else countVoxels<unsigned char, 8, false>((const unsigned char *)data, count, bins, sub.data());
+	}
+	else if (bytesPerVoxel == 4) {
+		countFloats((const float *)data, count, bins, sub.data());
+	}
+	else {
+		if (bins == 65536) countVoxels<unsigned short, 16, true>((const unsigned short *)data, count, bins, sub.data());
+		else countVoxels<unsigned short, 16, false>((const unsigned short *)data, count, bins, sub.data());
+	}
+
+	for (int i = 0; i < SUB_HISTOGRAMS; i++) {
+		addCounts(counts, sub.data() + (size_t)i * bins, bins);
+	}
+}
+
+void computeHistogram(const void *data, int w, int h, int d, int bytesPerVoxel, int bins, uint64_t *counts, int threads)
+{
+	size_t sliceVoxels = (size_t)w * h;
+	size_t voxels = sliceVoxels * d;
+
+	if (threads <= 0) threads = (int)std::thread::hardware_concurrency();
+	if ((size_t)threads > voxels / MIN_VOXELS_PER_THREAD) threads = (int)(voxels / MIN_VOXELS_PER_THREAD);
+	if (threads > d) threads = d;
+	if (threads < 1) threads = 1;
+
+	memset(counts, 0, bins * sizeof(uint64_t));
+	if (threads == 1) {
+		accumulateHistogram(data, voxels, bytesPerVoxel, bins, counts);
+		return;
+	}
+
+	// every thread takes a contiguous range of Z-slices and its own counts
+	std::vector<uint64_t> partial((size_t)threads * bins, 0);
+	std::vector<std::thread> workers;
+	for (int t = 0; t < threads; t++) {
+		int z0 = (int)((long long)d * t / threads);
+		int z1 = (int)((long long)d * (t + 1) / threads);
+		const unsigned char *first = (const unsigned char *)data + z0 * sliceVoxels * bytesPerVoxel;
+		uint64_t *target = partial.data() + (size_t)t * bins;
+		workers.push_back(std::thread(accumulateHistogram, first, (z1 - z0) * sliceVoxels, bytesPerVoxel, bins, target));
+	}
+	for (int t = 0; t < threads; t++) {
+		workers[t].join();
+		addCounts(counts, partial.data() + (size_t)t * bins, bins);
+	}
+}
+
+
+//
+// Micro-benchmark
+//
+static double elapsedMs(std::chrono::steady_clock::time_point start)
+{
+	return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+void benchmarkHistogram()
+{
+	struct { const char *name; int w, h, d; } sets[] = {
+		{ "lung", 256, 256, 128 },
+		{ "bonsai", 256, 256, 256 },
+		{ "CThead", 512, 512, 452 },
+	};
+	const int repeat = 5;
+	int threads = (int)std::thread::hardware_concurrency();
+
+	bool avx2 = false;
+#ifdef HISTOGRAM_AVX2
+	avx2 = cpuHasAvx2();
+#endif
+	printf("Histogram benchmark (best of %d, %d hardware threads%s)\n", repeat, threads,
+		avx2 ? ", AVX2 reduction" : "");
+
+	for (int s = 0; s < 3; s++) {
+		int w = sets[s].w, h = sets[s].h, d = sets[s].d;
+		size_t size = (size_t)w * h * d;
+
+		// CT-like content: air outside a noisy ellipsoid of tissue
+		unsigned char *data8 = new unsigned char[size];
+		unsigned short *data16 = new unsigned short[size];
+		srand(1);
+		for (int z = 0; z < d; z++) for (int y = 0; y < h; y++) for (int x = 0; x < w; x++) {
+			float fx = 2.0f * x / w - 1, fy = 2.0f * y / h - 1, fz = 2.0f * z / d - 1;
+			size_t i = ((size_t)z * h + y) * w + x;
+			data8[i] = fx * fx + fy * fy + fz * fz < 0.6f ? (unsigned char)(60 + rand() % 160) : 0;
+			data16[i] = (unsigned short)(data8[i] << 4);
+		}
+
+		double legacy = 1e30, single = 1e30, multi = 1e30, wide = 1e30;
+		float histogram[256];
+		volatile float sink = 0;	// keeps the legacy loop from being optimized away
+		uint64_t counts[256];
+		std::vector<uint64_t> counts16(4096);
+		for (int r = 0; r < repeat; r++) {
+			std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+			for (int i = 0; i < 256; i++) histogram[i] = 0;
+			for (size_t i = 0; i < size; i++) histogram[data8[i]]++;
+			for (int i = 0; i < 256; i++) histogram[i] /= size;
+			double t = elapsedMs(start);
+			sink += histogram[r];
+			if (t < legacy) legacy = t;
+
+			start = std::chrono::steady_clock::now();
+			computeHistogram(data8, w, h, d, 1, 256, counts, 1);
+			t = elapsedMs(start);
+			if (t < single) single = t;
+
+			start = std::chrono::steady_clock::now();
+			computeHistogram(data8, w, h, d, 1, 256, counts, threads);
+			t = elapsedMs(start);
+			if (t < multi) multi = t;
+
+			start = std::chrono::steady_clock::now();
+			computeHistogram(data16, w, h, d, 2, 4096, counts16.data(), threads);
+			t = elapsedMs(start);
+			if (t < wide) wide = t;
+		}
+
+		// the 8-bit and 16-bit paths must agree on the air bin
+		if (counts[0] != counts16[0])
+			printf("  %s: histogram mismatch!\n", sets[s].name);
+
+		printf("  %-7s %4dx%4dx%4d  legacy %8.2f ms | 1 thread %8.2f ms | %2d threads %8.2f ms (%5.1fx) | 16-bit, 4096 bins %8.2f ms\n",
+			sets[s].name, w, h, d, legacy, single, threads, multi, legacy / multi, wide);
+
+		delete[] data8;
+		delete[] data16;
+	}
+}
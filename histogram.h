@@ -0,0 +1,28 @@
+// histogram.h: voxel histograms for 8-bit, 16-bit and float volumes
+//
+// Every call counts into several private integer sub-histograms, so runs of
+// identical voxels (air in CT scans) do not serialize on a single counter,
+// and merges them at the end (with AVX2 if the CPU has it).
+// Voxel value v of an n-bit volume falls into bin (v * bins) >> n; float
+// voxels (bytesPerVoxel 4) are clamped to [0,1] and split into bins equally.
+//
+//////////////////////////////////////////////////////////////////////
+
+#ifndef HISTOGRAM_H
+#define HISTOGRAM_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Adds count voxels (bytesPerVoxel 1, 2 or 4) to counts[bins] on the calling thread.
+void accumulateHistogram(const void *data, size_t count, int bytesPerVoxel, int bins, uint64_t *counts);
+
+// Histogram of a whole w*h*d volume. The Z-slices are split across threads
+// (0: one per hardware thread). counts[bins] is overwritten.
+void computeHistogram(const void *data, int w, int h, int d, int bytesPerVoxel, int bins, uint64_t *counts, int threads = 0);
+
+// Times the scalar float loop that load3Dfile used to run against
+// computeHistogram on the sizes of the bundled datasets and prints the result.
+void benchmarkHistogram();
+
+#endif
@@ -0,0 +1,135 @@
+// imagefile.cpp
+//
+// PPM and stored-deflate PNG writers
+//
+//////////////////////////////////////////////////////////////////////
+
+#include <stdio.h>
+#include <string.h>
+
+#include <vector>
+
+#include "imagefile.h"
+
+
+bool writePPM(const char *filename, int width, int height, const unsigned char *rgb)
+{
+	FILE *fp = fopen(filename, "wb");
+	if (!fp) return false;
+	fprintf(fp, "P6\n%d %d\n255\n", width, height);
+	bool ok = fwrite(rgb, 3, (size_t)width * height, fp) == (size_t)width * height;
+	return fclose(fp) == 0 && ok;
+}
+
+
+//
+// PNG
+//
+struct CrcTable
+{
+	unsigned int entries[256];
+
+	CrcTable()
+	{
+		for (unsigned int n = 0; n < 256; n++) {
+			unsigned int c = n;
+			for (int k = 0; k < 8; k++) c = c & 1 ? 0xedb88320 ^ (c >> 1) : c >> 1;
+			entries[n] = c;
+		}
+	}
+};
+
+static unsigned int crc32(unsigned int crc, const unsigned char *data, size_t size)
+{
+	// built once on first use; the writer and render threads both get here
+	static const CrcTable table;
+
+	crc = ~crc;
+	for (size_t i = 0; i < size; i++) {
+		crc = table.entries[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+	}
+	return ~crc;
+}
+
+static void putBigEndian(std::vector<unsigned char> *out, unsigned int v)
+{
+	out->push_back((unsigned char)(v >> 24));
+	out->push_back((unsigned char)(v >> 16));
+	out->push_back((unsigned char)(v >> 8));
+	out->push_back((unsigned char)v);
+}
+
+static bool writeChunk(FILE *fp, const char *type, const std::vector<unsigned char> &data)
+{
+	std::vector<unsigned char> chunk;
+	putBigEndian(&chunk, (unsigned int)data.size());
+	chunk.insert(chunk.end(), type, type + 4);
+	chunk.insert(chunk.end(), data.begin(), data.end());
+	putBigEndian(&chunk, crc32(0, chunk.data() + 4, chunk.size() - 4));
+	return fwrite(chunk.data(), 1, chunk.size(), fp) == chunk.size();
+}
+
+bool writePNG(const char *filename, int width, int height, const unsigned char *rgb)
+{
+	static const unsigned char signature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n' };
+
+	std::vector<unsigned char> header;
+	putBigEndian(&header, width);
+	putBigEndian(&header, height);
+	header.push_back(8);	// bit depth
+	header.push_back(2);	// colour type RGB
+	header.push_back(0);	// deflate
+	header.push_back(0);	// adaptive filtering
+	header.push_back(0);	// no interlace
+
+	// every row starts with filter type 0 (none)
+	size_t rowBytes = (size_t)width * 3;
+	std::vector<unsigned char> raw;
+	raw.reserve((rowBytes + 1) * height);
+	for (int y = 0; y < height; y++) {
+		raw.push_back(0);
+		raw.insert(raw.end(), rgb + y * rowBytes, rgb + (y + 1) * rowBytes);
+	}
+
+	// zlib stream of stored blocks of at most 65535 bytes
+	std::vector<unsigned char> data;
+	data.push_back(0x78);
+	data.push_back(0x01);
+	size_t offset = 0;
+	do {
+		size_t length = raw.size() - offset;
+		if (length > 65535) length = 65535;
+		data.push_back(offset + length == raw.size() ? 1 : 0);
+		data.push_back((unsigned char)length);
+		data.push_back((unsigned char)(length >> 8));
+		data.push_back((unsigned char)~length);
+		data.push_back((unsigned char)(~length >> 8));
+		data.insert(data.end(), raw.begin() + offset, raw.begin() + offset + length);
+		offset += length;
+	} while (offset < raw.size());
+
+	unsigned int a = 1, b = 0;
+	for (size_t i = 0; i < raw.size(); i++) {
+		a = (a + raw[i]) % 65521;
+		b = (b + a) % 65521;
+	}
+	putBigEndian(&data, (b << 16) | a);
+
+	FILE *fp = fopen(filename, "wb");
+	if (!fp) return false;
+	bool ok = fwrite(signature, 1, 8, fp) == 8 &&
+		writeChunk(fp, "IHDR", header) &&
+		writeChunk(fp, "IDAT", data) &&
+		writeChunk(fp, "IEND", std::vector<unsigned char>());
+	return fclose(fp) == 0 && ok;
+}
+
+bool writeImage(const char *filename, int width, int height, const unsigned char *rgb)
+{
+	size_t length = strlen(filename);
+	bool png = length >= 4 && (!strcmp(filename + length - 4, ".png") || !strcmp(filename + length - 4, ".PNG"));
+
+	bool ok = png ? writePNG(filename, width, height, rgb) : writePPM(filename, width, height, rgb);
+	if (!ok) printf("Cannot write %s\n", filename);
+	return ok;
+}
@@ -0,0 +1,18 @@
+// imagefile.h: writing rendered frames
+//
+// Images are 8-bit RGB, rows stored top to bottom. PNG files are written
+// with uncompressed (stored) deflate blocks, which every reader accepts and
+// which needs no zlib.
+//
+//////////////////////////////////////////////////////////////////////
+
+#ifndef IMAGEFILE_H
+#define IMAGEFILE_H
+
+bool writePPM(const char *filename, int width, int height, const unsigned char *rgb);
+bool writePNG(const char *filename, int width, int height, const unsigned char *rgb);
+
+// PNG if filename ends in .png, PPM otherwise. Prints the reason on failure.
+bool writeImage(const char *filename, int width, int height, const unsigned char *rgb);
+
+#endif
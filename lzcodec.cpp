@@ -0,0 +1,153 @@
+// lzcodec.cpp
+//
+// LZ77 block compressor and bounds-checked decompressor
+//
+//////////////////////////////////////////////////////////////////////
+
+#include <string.h>
+
+#include <vector>
+
+#include "lzcodec.h"
+
+#define LZ_MIN_MATCH 4
+#define LZ_MAX_OFFSET 65535
+#define LZ_HASH_BITS 14
+
+
+static inline unsigned int read32(const unsigned char *p)
+{
+	unsigned int v;
+	memcpy(&v, p, 4);
+	return v;
+}
+
+static inline unsigned int hashSequence(unsigned int sequence)
+{
+	return (sequence * 2654435761u) >> (32 - LZ_HASH_BITS);
+}
+
+// the nibble of a length, followed by its extension bytes
+static inline unsigned char *writeLength(unsigned char *out, size_t length)
+{
+	for (length -= 15; length >= 255; length -= 255) *out++ = 255;
+	*out++ = (unsigned char)length;
+	return out;
+}
+
+static unsigned char *writeSequence(unsigned char *out, const unsigned char *literals, size_t literalCount,
+	size_t offset, size_t matchLength)
+{
+	size_t matchCode = matchLength - LZ_MIN_MATCH;
+	unsigned char *token = out++;
+	*token = (unsigned char)(((literalCount < 15 ? literalCount : 15) << 4) | (matchCode < 15 ? matchCode : 15));
+	if (literalCount >= 15) out = writeLength(out, literalCount);
+	memcpy(out, literals, literalCount);
+	out += literalCount;
+
+	out[0] = (unsigned char)offset;
+	out[1] = (unsigned char)(offset >> 8);
+	out += 2;
+	if (matchCode >= 15) out = writeLength(out, matchCode);
+	return out;
+}
+
+size_t lzCompressBound(size_t size)
+{
+	return size + size / 255 + 16;
+}
+
+size_t lzCompress(const unsigned char *input, size_t size, unsigned char *output)
+{
+	// positions plus one, 0: empty
+	std::vector<unsigned int> table(1 << LZ_HASH_BITS, 0);
+
+	unsigned char *out = output;
+	size_t anchor = 0, i = 0;
+	size_t limit = size > LZ_MIN_MATCH ? size - LZ_MIN_MATCH : 0;
+	while (i < limit) {
+		unsigned int sequence = read32(input + i);
+		unsigned int *slot = &table[hashSequence(sequence)];
+		size_t candidate = *slot;
+		*slot = (unsigned int)(i + 1);
+
+		if (candidate == 0 || i - (candidate - 1) > LZ_MAX_OFFSET || read32(input + candidate - 1) != sequence) {
+			// skip faster through data that does not compress
+			i += 1 + ((i - anchor) >> 6);
+			continue;
+		}
+		size_t match = candidate - 1;
+
+		size_t length = LZ_MIN_MATCH;
+		while (i + length < size && input[match + length] == input[i + length]) length++;
+		while (i > anchor && match > 0 && input[i - 1] == input[match - 1]) {
+			i--;
+			match--;
+			length++;
+		}
+
+		out = writeSequence(out, input + anchor, i - anchor, i - match, length);
+		i += length;
+		anchor = i;
+		if (i - 2 < limit) table[hashSequence(read32(input + i - 2))] = (unsigned int)(i - 1);
+	}
+
+	// the last literals
+	size_t literalCount = size - anchor;
+	*out++ = (unsigned char)((literalCount < 15 ? literalCount : 15) << 4);
+	if (literalCount >= 15) out = writeLength(out, literalCount);
+	if (literalCount > 0) memcpy(out, input + anchor, literalCount);
+	out += literalCount;
+	return out - output;
+}
+
+static inline bool readLength(const unsigned char **in, const unsigned char *end, size_t *length)
+{
+	unsigned char b;
+	do {
+		if (*in >= end) return false;
+		b = *(*in)++;
+		*length += b;
+	} while (b == 255);
+	return true;
+}
+
+bool lzDecompress(const unsigned char *input, size_t size, unsigned char *output, size_t outputSize)
+{
+	const unsigned char *in = input, *inEnd = input + size;
+	unsigned char *out = output, *outEnd = output + outputSize;
+
+	while (in < inEnd) {
+		unsigned char token = *in++;
+
+		size_t literalCount = token >> 4;
+		if (literalCount == 15 && !readLength(&in, inEnd, &literalCount)) return false;
+		if (literalCount > (size_t)(inEnd - in) || literalCount > (size_t)(outEnd - out)) return false;
+		memcpy(out, in, literalCount);
+		in += literalCount;
+		out += literalCount;
+		if (in == inEnd) break;
+
+		if (inEnd - in < 2) return false;
+		size_t offset = in[0] | (in[1] << 8);
+		in += 2;
+		size_t length = token & 15;
+		if (length == 15 && !readLength(&in, inEnd, &length)) return false;
+		length += LZ_MIN_MATCH;
+		if (offset == 0 || offset > (size_t)(out - output) || length > (size_t)(outEnd - out)) return false;
+
+		const unsigned char *match = out - offset;
+		if (offset >= 8 && length + 8 <= (size_t)(outEnd - out)) {
+			// every 8 bytes read were written before, so overlapping runs repeat correctly
+			for (size_t k = 0; k < length; k += 8) memcpy(out + k, match + k, 8);
+		}
+		else if (offset == 1) {
+			memset(out, match[0], length);
+		}
+		else {
+			for (size_t k = 0; k < length; k++) out[k] = match[k];
+		}
+		out += length;
+	}
+	return out == outEnd;
+}
@@ -0,0 +1,32 @@
+// lzcodec.h: byte-oriented LZ77 block compression
+//
+// A small LZ4-style codec for independently compressed blocks: a greedy
+// matcher over a hash table of 4-byte sequences and 64 KB back references,
+// and a decoder that copies 8 bytes at a time. It trades ratio for speed so
+// that decompression outruns the disk the blocks come from.
+//
+// A block is a run of sequences: a token (literal count in the high nibble,
+// match length minus 4 in the low one, 15 meaning that bytes of 255 and one
+// below follow), the literals, then a 2-byte little-endian offset back into
+// the output. The last sequence has literals only.
+//
+//////////////////////////////////////////////////////////////////////
+
+#ifndef LZCODEC_H
+#define LZCODEC_H
+
+#include <stddef.h>
+
+// Largest compressed size of size bytes.
+size_t lzCompressBound(size_t size);
+
+// Compresses size bytes of input into output, which must hold
+// lzCompressBound(size) bytes. Returns the compressed size.
+size_t lzCompress(const unsigned char *input, size_t size, unsigned char *output);
+
+// Decompresses a block of size bytes into exactly outputSize bytes. Returns
+// false if the block is damaged or does not decompress to outputSize bytes;
+// it never reads or writes outside the two buffers.
+bool lzDecompress(const unsigned char *input, size_t size, unsigned char *output, size_t outputSize);
+
+#endif
@@ -0,0 +1,276 @@
+// offscreen.cpp
+//
+// EGL context, framebuffer with asynchronous readback and frame writer thread
+//
+//////////////////////////////////////////////////////////////////////
+
+#include <stdio.h>
+#include <string.h>
+
+#include <chrono>
+
+#ifdef HAVE_EGL
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#endif
+
+#include "offscreen.h"
+#include "imagefile.h"
+
+// frames waiting for the writer thread before the renderer blocks
+#define MAX_QUEUED_FRAMES 4
+
+
+//
+// EGL context
+//
+#ifdef HAVE_EGL
+static EGLDisplay display = EGL_NO_DISPLAY;
+static EGLContext context = EGL_NO_CONTEXT;
+static EGLSurface surface = EGL_NO_SURFACE;
+#endif
+
+bool createOffscreenContext()
+{
+#ifdef HAVE_EGL
+	// Mesa's surfaceless platform first, it needs neither a display nor a GPU
+	PFNEGLGETPLATFORMDISPLAYEXTPROC getPlatformDisplay =
+		(PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress("eglGetPlatformDisplayEXT");
+	EGLint major, minor;
+	bool surfaceless = false;
+#ifdef EGL_PLATFORM_SURFACELESS_MESA
+	if (getPlatformDisplay) {
+		display = getPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, NULL);
+		surfaceless = display != EGL_NO_DISPLAY && eglInitialize(display, &major, &minor);
+	}
+#endif
+	if (!surfaceless) {
+		display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+		if (display == EGL_NO_DISPLAY || !eglInitialize(display, &major, &minor)) {
+			printf("EGL is not available\n");
+			return false;
+		}
+	}
+
+	EGLint configAttributes[] = {
+		EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+		EGL_SURFACE_TYPE, surfaceless ? 0 : EGL_PBUFFER_BIT,
+		EGL_NONE
+	};
+	EGLConfig config = NULL;
+	EGLint configs = 0;
+	eglChooseConfig(display, configAttributes, &config, 1, &configs);
+	if (!eglBindAPI(EGL_OPENGL_API)) {
+		printf("EGL cannot create desktop OpenGL contexts\n");
+		destroyOffscreenContext();
+		return false;
+	}
+
+	EGLint contextAttributes[] = {
+		EGL_CONTEXT_MAJOR_VERSION, 3,
+		EGL_CONTEXT_MINOR_VERSION, 3,
+		EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_COMPATIBILITY_PROFILE_BIT,
+		EGL_NONE
+	};
+	context = eglCreateContext(display, configs ? config : NULL, EGL_NO_CONTEXT, contextAttributes);
+	if (context == EGL_NO_CONTEXT) {
+		printf("Cannot create an EGL context (error 0x%x)\n", eglGetError());
+		destroyOffscreenContext();
+		return false;
+	}
+
+	// a 1x1 pbuffer where surfaceless contexts are not supported; all drawing goes to the framebuffer object
+	if (!surfaceless && configs) {
+		EGLint pbufferAttributes[] = { EGL_WIDTH, 1, EGL_HEIGHT, 1, EGL_NONE };
+		surface = eglCreatePbufferSurface(display, config, pbufferAttributes);
+	}
+	if (!eglMakeCurrent(display, surface, surface, context)) {
+		printf("Cannot make the EGL context current (error 0x%x)\n", eglGetError());
+		destroyOffscreenContext();
+		return false;
+	}
+
+	printf("Offscreen EGL %d.%d context (%s)\n", major, minor, surfaceless ? "surfaceless" : "pbuffer");
+	return true;
+#else
+	return false;
+#endif
+}
+
+void destroyOffscreenContext()
+{
+#ifdef HAVE_EGL
+	if (display == EGL_NO_DISPLAY) return;
+	eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+	if (surface != EGL_NO_SURFACE) eglDestroySurface(display, surface);
+	if (context != EGL_NO_CONTEXT) eglDestroyContext(display, context);
+	eglTerminate(display);
+	display = EGL_NO_DISPLAY;
+	context = EGL_NO_CONTEXT;
+	surface = EGL_NO_SURFACE;
+#endif
+}
+
+
+//
+// Framebuffer and readback
+//
+bool createOffscreenTarget(int width, int height, OffscreenTarget *target)
+{
+	target->width = width;
+	target->height = height;
+
+	glGenRenderbuffers(1, &target->color);
+	glBindRenderbuffer(GL_RENDERBUFFER, target->color);
+	glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, width, height);
+	glGenRenderbuffers(1, &target->depth);
+	glBindRenderbuffer(GL_RENDERBUFFER, target->depth);
+	glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, width, height);
+
+	glGenFramebuffers(1, &target->framebuffer);
+	glBindFramebuffer(GL_FRAMEBUFFER, target->framebuffer);
+	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, target->color);
+	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, target->depth);
+	glDrawBuffer(GL_COLOR_ATTACHMENT0);
+	glReadBuffer(GL_COLOR_ATTACHMENT0);
+	if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+		printf("Offscreen framebuffer is incomplete\n");
+		return false;
+	}
+
+	glGenBuffers(2, target->packBuffers);
+	for (int i = 0; i < 2; i++) {
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, target->packBuffers[i]);
+		glBufferData(GL_PIXEL_PACK_BUFFER, (GLsizeiptr)width * height * 4, NULL, GL_STREAM_READ);
+		target->fences[i] = 0;
+	}
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+	return true;
+}
+
+void destroyOffscreenTarget(OffscreenTarget *target)
+{
+	for (int i = 0; i < 2; i++) {
+		if (target->fences[i]) glDeleteSync(target->fences[i]);
+	}
+	glDeleteBuffers(2, target->packBuffers);
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	glDeleteFramebuffers(1, &target->framebuffer);
+	glDeleteRenderbuffers(1, &target->color);
+	glDeleteRenderbuffers(1, &target->depth);
+}
+
+void startReadback(OffscreenTarget *target, int slot)
+{
+	// into the buffer object: glReadPixels returns without waiting for the frame
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, target->packBuffers[slot]);
+	glPixelStorei(GL_PACK_ALIGNMENT, 1);
+	glReadPixels(0, 0, target->width, target->height, GL_RGBA, GL_UNSIGNED_BYTE, 0);
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+	if (target->fences[slot]) glDeleteSync(target->fences[slot]);
+	target->fences[slot] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	glFlush();
+}
+
+void finishReadback(OffscreenTarget *target, int slot, std::vector<unsigned char> *pixels)
+{
+	size_t size = (size_t)target->width * target->height * 4;
+	pixels->resize(size);
+
+	if (target->fences[slot]) {
+		glClientWaitSync(target->fences[slot], GL_SYNC_FLUSH_COMMANDS_BIT, GL_TIMEOUT_IGNORED);
+		glDeleteSync(target->fences[slot]);
+		target->fences[slot] = 0;
+	}
+
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, target->packBuffers[slot]);
+	void *mapped = glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, size, GL_MAP_READ_BIT);
+	if (mapped) {
+		memcpy(pixels->data(), mapped, size);
+		glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+	}
+	else {
+		glGetBufferSubData(GL_PIXEL_PACK_BUFFER, 0, size, pixels->data());
+	}
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+}
+
+
+//
+// Writer thread
+//
+static void writeFrames(FrameWriter *writer)
+{
+	std::vector<unsigned char> rgb;
+	for (;;) {
+		FrameWriter::Frame frame;
+		{
+			std::unique_lock<std::mutex> guard(writer->lock);
+			writer->signal.wait(guard, [&] { return !writer->queue.empty() || writer->closing; });
+			if (writer->queue.empty()) return;
+			frame.filename.swap(writer->queue.front().filename);
+			frame.width = writer->queue.front().width;
+			frame.height = writer->queue.front().height;
+			frame.pixels.swap(writer->queue.front().pixels);
+		}
+
+		// RGBA bottom-up to RGB top-down
+		rgb.resize((size_t)frame.width * frame.height * 3);
+		for (int y = 0; y < frame.height; y++) {
+			const unsigned char *in = frame.pixels.data() + (size_t)(frame.height - 1 - y) * frame.width * 4;
+			unsigned char *out = rgb.data() + (size_t)y * frame.width * 3;
+			for (int x = 0; x < frame.width; x++) {
+				out[x * 3 + 0] = in[x * 4 + 0];
+				out[x * 3 + 1] = in[x * 4 + 1];
+				out[x * 3 + 2] = in[x * 4 + 2];
+			}
+		}
+		bool ok = writeImage(frame.filename.c_str(), frame.width, frame.height, rgb.data());
+
+		{
+			std::lock_guard<std::mutex> guard(writer->lock);
+			writer->queue.pop_front();
+			if (!ok) writer->failures++;
+		}
+		writer->signal.notify_all();
+	}
+}
+
+void startFrameWriter(FrameWriter *writer)
+{
+	writer->closing = false;
+	writer->failures = 0;
+	writer->waitMs = 0;
+	writer->thread = std::thread(writeFrames, writer);
+}
+
+void queueFrame(FrameWriter *writer, const char *filename, int width, int height, std::vector<unsigned char> *pixels)
+{
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	{
+		// the frame being written stays in the queue until it is done
+		std::unique_lock<std::mutex> guard(writer->lock);
+		writer->signal.wait(guard, [&] { return writer->queue.size() < MAX_QUEUED_FRAMES; });
+		writer->queue.push_back(FrameWriter::Frame());
+		FrameWriter::Frame &frame = writer->queue.back();
+		frame.filename = filename;
+		frame.width = width;
+		frame.height = height;
+		frame.pixels.swap(*pixels);
+	}
+	writer->signal.notify_all();
+	writer->waitMs += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+	pixels->clear();
+}
+
+int finishFrameWriter(FrameWriter *writer)
+{
+	{
+		std::lock_guard<std::mutex> guard(writer->lock);
+		writer->closing = true;
+	}
+	writer->signal.notify_all();
+	writer->thread.join();
+	return writer->failures;
+}
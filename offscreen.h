@@ -0,0 +1,77 @@
+// offscreen.h: rendering without windows
+//
+// For batch rendering the GL context comes from EGL without any surface
+// (Mesa's surfaceless platform, or a pbuffer), so neither a display server
+// nor GLUT windows are needed. Frames are rendered into a framebuffer
+// object, read back through a pair of pixel-pack buffers one frame late,
+// so glReadPixels never stalls the next frame, and encoded to disk by a
+// writer thread while the following frames render.
+//
+//////////////////////////////////////////////////////////////////////
+
+#ifndef OFFSCREEN_H
+#define OFFSCREEN_H
+
+#include <GL/glew.h>
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Makes an EGL context current (OpenGL 3.3 compatibility profile). Returns
+// false if EGL is not available (built without HAVE_EGL) or fails; the
+// caller can then fall back to a hidden window.
+bool createOffscreenContext();
+void destroyOffscreenContext();
+
+struct OffscreenTarget
+{
+	int width, height;
+	GLuint framebuffer, color, depth;
+	GLuint packBuffers[2];			// readbacks of two frames in flight
+	GLsync fences[2];
+};
+
+// Creates and binds an RGBA8 + depth framebuffer of the given size.
+bool createOffscreenTarget(int width, int height, OffscreenTarget *target);
+void destroyOffscreenTarget(OffscreenTarget *target);
+
+// Starts the readback of the frame just rendered into slot (0 or 1) of the target.
+void startReadback(OffscreenTarget *target, int slot);
+
+// Waits for the readback in slot and copies it into pixels (RGBA, bottom row first).
+void finishReadback(OffscreenTarget *target, int slot, std::vector<unsigned char> *pixels);
+
+struct FrameWriter
+{
+	struct Frame
+	{
+		std::string filename;
+		int width, height;
+		std::vector<unsigned char> pixels;
+	};
+
+	std::thread thread;
+	std::mutex lock;
+	std::condition_variable signal;
+	std::deque<Frame> queue;
+	bool closing;
+	int failures;
+	double waitMs;		// time the render thread waited for a free queue slot
+};
+
+void startFrameWriter(FrameWriter *writer);
+
+// Hands an RGBA frame read back from GL (bottom row first) to the writer
+// thread, which writes it as PNG or PPM by the extension of filename.
+// Blocks while too many frames are queued. pixels is left empty.
+void queueFrame(FrameWriter *writer, const char *filename, int width, int height, std::vector<unsigned char> *pixels);
+
+// Writes the remaining frames and stops the thread. Returns the number of
+// frames that could not be written.
+int finishFrameWriter(FrameWriter *writer);
+
+#endif
@@ -0,0 +1,340 @@
+// pagedvolume.cpp
+//
+// Brick pool, page table and least recently used residency of paged volumes
+//
+//////////////////////////////////////////////////////////////////////
+
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+
+#include <algorithm>
+#include <thread>
+#include <vector>
+
+#include "pagedvolume.h"
+#include "volumeupload.h"
+#include "textureunits.h"
+
+
+// texels of the volume texture per voxel: R8, R16 or R16F
+static int texelBytes(VoxelType type)
+{
+	return type == VOXEL_UINT8 ? 1 : 2;
+}
+
+static void pageCoordinates(const PagedVolume *v, int page, int coordinates[3])
+{
+	coordinates[0] = page % v->pages[0];
+	coordinates[1] = (page / v->pages[0]) % v->pages[1];
+	coordinates[2] = page / (v->pages[0] * v->pages[1]);
+}
+
+static void slotCoordinates(const PagedVolume *v, int slot, int coordinates[3])
+{
+	coordinates[0] = slot % v->slots[0];
+	coordinates[1] = (slot / v->slots[0]) % v->slots[1];
+	coordinates[2] = slot / (v->slots[0] * v->slots[1]);
+}
+
+//
+// Copies a page and its apron out of the file mapping, clamped at the faces
+// of the volume like GL_CLAMP_TO_EDGE, and converts it for the texture
+//
+static void copyPage(const PagedVolume *v, int page, unsigned char *result)
+{
+	const int w = v->desc.dims[0], h = v->desc.dims[1], d = v->desc.dims[2];
+	const int size = voxelSize(v->desc.type);
+
+	int p[3];
+	pageCoordinates(v, page, p);
+	int xs[PAGE_STORAGE], ys[PAGE_STORAGE], zs[PAGE_STORAGE];
+	for (int i = 0; i < PAGE_STORAGE; i++) {
+		xs[i] = std::min(std::max(p[0] * PAGE_SIZE - 1 + i, 0), w - 1);
+		ys[i] = std::min(std::max(p[1] * PAGE_SIZE - 1 + i, 0), h - 1);
+		zs[i] = std::min(std::max(p[2] * PAGE_SIZE - 1 + i, 0), d - 1);
+	}
+
+	for (int z = 0; z < PAGE_STORAGE; z++)
+	for (int y = 0; y < PAGE_STORAGE; y++) {
+		const unsigned char *row = v->src.data + ((size_t)zs[z] * h + ys[y]) * w * size;
+		unsigned char *out = result + ((size_t)z * PAGE_STORAGE + y) * PAGE_STORAGE * size;
+
+		// runs of consecutive voxels in one copy, the clamped ends repeat the face
+		for (int x = 0; x < PAGE_STORAGE; ) {
+			int run = 1;
+			while (x + run < PAGE_STORAGE && xs[x + run] == xs[x] + run) run++;
+			memcpy(out + (size_t)x * size, row + (size_t)xs[x] * size, (size_t)run * size);
+			x += run;
+		}
+	}
+
+	if (needsByteSwap(&v->desc) || v->desc.type == VOXEL_INT16) {
+		convertVoxels(result, v->slotBytes, &v->desc, result);
+	}
+}
+
+static void setPageEntry(const PagedVolume *v, int page, const unsigned char entry[4])
+{
+	int p[3];
+	pageCoordinates(v, page, p);
+	glTexSubImage3D(GL_TEXTURE_3D, 0, p[0], p[1], p[2], 1, 1, 1, GL_RGBA_INTEGER, GL_UNSIGNED_BYTE, entry);
+}
+
+// A free slot, else the least recently used one whose page the last
+// PAGE_PROTECTION_FRAMES feedbacks did not see; -1 if there is none
+static int findSlot(PagedVolume *v)
+{
+	// slots are handed out in order and only ever reused, never freed
+	if (v->resident < v->slotCount) return v->resident++;
+
+	int best = -1;
+	for (int s = 0; s < v->slotCount; s++) {
+		if (v->frame - v->slotUsed[s] < PAGE_PROTECTION_FRAMES) continue;
+		if (best < 0 || v->slotUsed[s] < v->slotUsed[best]) best = s;
+	}
+	return best;
+}
+
+
+bool createPagedVolume(const VolumeDesc *desc, const VolumeSource *src, size_t poolBytes, PagedVolume *v)
+{
+	v->desc = *desc;
+	v->src = *src;
+
+	int pageCount = 1;
+	for (int i = 0; i < 3; i++) {
+		v->pages[i] = (desc->dims[i] + PAGE_SIZE - 1) / PAGE_SIZE;
+		pageCount *= v->pages[i];
+		if (v->pages[i] > 255) {
+			printf("%d voxels along an axis are too many for the page table\n", desc->dims[i]);
+			return false;
+		}
+	}
+
+	// as many slots as the budget allows, in a pool no side of which exceeds the texture limit
+	size_t slotTexels = (size_t)PAGE_STORAGE * PAGE_STORAGE * PAGE_STORAGE;
+	int count = (int)std::min(poolBytes / (slotTexels * texelBytes(desc->type)), (size_t)pageCount);
+	if (count < 1) count = 1;
+	GLint maxSize;
+	glGetIntegerv(GL_MAX_3D_TEXTURE_SIZE, &maxSize);
+	int perAxis = maxSize / PAGE_STORAGE;
+	int side = (int)cbrt((double)count);
+	while ((side + 1) * (side + 1) * (side + 1) <= count) side++;
+	side = std::max(std::min(side, perAxis), 1);
+	v->slots[0] = v->slots[1] = side;
+	v->slots[2] = std::max(std::min(count / (side * side), perAxis), 1);
+	v->slotCount = v->slots[0] * v->slots[1] * v->slots[2];
+	v->slotBytes = slotTexels * voxelSize(desc->type);
+
+	GLenum internalFormat, format, pixelType;
+	volumeTextureFormat(desc->type, &internalFormat, &format, &pixelType);
+	glGenTextures(1, &v->poolTex);
+	glBindTexture(GL_TEXTURE_3D, v->poolTex);
+	glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+	glTexImage3D(GL_TEXTURE_3D, 0, internalFormat, v->slots[0] * PAGE_STORAGE, v->slots[1] * PAGE_STORAGE,
+		v->slots[2] * PAGE_STORAGE, 0, format, pixelType, NULL);
+
+	std::vector<unsigned char> table((size_t)pageCount * 4, 0);
+	glGenTextures(1, &v->pageTableTex);
+	glBindTexture(GL_TEXTURE_3D, v->pageTableTex);
+	glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glTexImage3D(GL_TEXTURE_3D, 0, GL_RGBA8UI, v->pages[0], v->pages[1], v->pages[2], 0,
+		GL_RGBA_INTEGER, GL_UNSIGNED_BYTE, table.data());
+
+	v->pageSlot.assign(pageCount, -1);
+	v->slotPage.assign(v->slotCount, -1);
+	v->slotUsed.assign(v->slotCount, 0);
+	v->pageRequests.assign(pageCount, 0);
+	v->frame = PAGE_PROTECTION_FRAMES;
+
+	v->feedbackFramebuffer = v->feedbackTex = 0;
+	v->feedbackWidth = v->feedbackHeight = 0;
+	glGenBuffers(1, &v->feedbackBuffer);
+	v->feedbackPending = false;
+
+	v->maxLoadsPerFrame = 32;
+	v->resident = v->missing = 0;
+	v->pagesLoaded = 0;
+	v->poolFullWarned = false;
+
+	printf("Paged volume: %dx%dx%d pages of %d^3 voxels, pool of %dx%dx%d slots (%.1f MB) for %d pages\n",
+		v->pages[0], v->pages[1], v->pages[2], PAGE_SIZE, v->slots[0], v->slots[1], v->slots[2],
+		pagedVolumeBytes(v) / 1048576.0, pageCount);
+	return true;
+}
+
+void destroyPagedVolume(PagedVolume *v)
+{
+	glDeleteTextures(1, &v->poolTex);
+	glDeleteTextures(1, &v->pageTableTex);
+	if (v->feedbackFramebuffer) {
+		glDeleteFramebuffers(1, &v->feedbackFramebuffer);
+		glDeleteTextures(1, &v->feedbackTex);
+	}
+	glDeleteBuffers(1, &v->feedbackBuffer);
+	closeVolumeSource(&v->src);
+}
+
+size_t pagedVolumeBytes(const PagedVolume *v)
+{
+	size_t slotTexels = (size_t)PAGE_STORAGE * PAGE_STORAGE * PAGE_STORAGE;
+	return v->slotCount * slotTexels * texelBytes(v->desc.type) + v->pageSlot.size() * 4;
+}
+
+void beginVisibilityFeedback(PagedVolume *v, int width, int height)
+{
+	int w = (width + FEEDBACK_SCALE - 1) / FEEDBACK_SCALE;
+	int h = (height + FEEDBACK_SCALE - 1) / FEEDBACK_SCALE;
+	glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &v->previousFramebuffer);
+	glGetIntegerv(GL_VIEWPORT, v->previousViewport);
+
+	if (w != v->feedbackWidth || h != v->feedbackHeight) {
+		if (v->feedbackFramebuffer) {
+			glDeleteFramebuffers(1, &v->feedbackFramebuffer);
+			glDeleteTextures(1, &v->feedbackTex);
+		}
+		v->feedbackWidth = w;
+		v->feedbackHeight = h;
+		v->feedbackPending = false;
+
+		// on the page table's unit, whose 2D target nothing else uses
+		glActiveTexture(GL_TEXTURE0 + UNIT_PAGE_TABLE);
+		glGenTextures(1, &v->feedbackTex);
+		glBindTexture(GL_TEXTURE_2D, v->feedbackTex);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8UI, w, h, 0, GL_RGBA_INTEGER, GL_UNSIGNED_BYTE, NULL);
+		glBindTexture(GL_TEXTURE_2D, 0);
+		glActiveTexture(GL_TEXTURE0);
+
+		glGenFramebuffers(1, &v->feedbackFramebuffer);
+		glBindFramebuffer(GL_FRAMEBUFFER, v->feedbackFramebuffer);
+		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, v->feedbackTex, 0);
+		if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+			printf("Visibility feedback framebuffer is incomplete\n");
+		}
+
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, v->feedbackBuffer);
+		glBufferData(GL_PIXEL_PACK_BUFFER, (size_t)w * h * 4, NULL, GL_STREAM_READ);
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+	}
+
+	glBindFramebuffer(GL_FRAMEBUFFER, v->feedbackFramebuffer);
+	glViewport(0, 0, w, h);
+	const GLuint none[4] = { 0, 0, 0, 0 };
+	glClearBufferuiv(GL_COLOR, 0, none);
+}
+
+void endVisibilityFeedback(PagedVolume *v)
+{
+	// into the pixel-pack buffer, so that the frame does not wait for the pass
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, v->feedbackBuffer);
+	glReadPixels(0, 0, v->feedbackWidth, v->feedbackHeight, GL_RGBA_INTEGER, GL_UNSIGNED_BYTE, 0);
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+	v->feedbackPending = true;
+
+	glBindFramebuffer(GL_FRAMEBUFFER, v->previousFramebuffer);
+	glViewport(v->previousViewport[0], v->previousViewport[1], v->previousViewport[2], v->previousViewport[3]);
+}
+
+int updateResidency(PagedVolume *v)
+{
+	if (!v->feedbackPending) return 0;
+	v->feedbackPending = false;
+	v->frame++;
+
+	// pages seen in use keep their slots, missing ones are counted per pixel
+	std::vector<int> requested;
+	size_t pixelCount = (size_t)v->feedbackWidth * v->feedbackHeight;
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, v->feedbackBuffer);
+	const unsigned char *pixels = (const unsigned char *)glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, pixelCount * 4, GL_MAP_READ_BIT);
+	if (pixels) {
+		for (size_t i = 0; i < pixelCount; i++) {
+			const unsigned char *p = pixels + i * 4;
+			if (p[3] == 0 || p[0] >= v->pages[0] || p[1] >= v->pages[1] || p[2] >= v->pages[2]) continue;
+			int page = (p[2] * v->pages[1] + p[1]) * v->pages[0] + p[0];
+			int slot = v->pageSlot[page];
+			if (slot >= 0) v->slotUsed[slot] = v->frame;
+			else if (v->pageRequests[page]++ == 0) requested.push_back(page);
+		}
+		glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+	}
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+	std::sort(requested.begin(), requested.end(), [v](int a, int b) {
+		return v->pageRequests[a] > v->pageRequests[b] || (v->pageRequests[a] == v->pageRequests[b] && a < b);
+	});
+
+	// assign the slots; the pages they held leave the page table first
+	std::vector<int> loads, loadSlots, evicted;
+	for (size_t r = 0; r < requested.size() && (int)loads.size() < v->maxLoadsPerFrame; r++) {
+		int slot = findSlot(v);
+		if (slot < 0) {
+			if (!v->poolFullWarned) printf("The page pool is too small for the view, use a larger -pool\n");
+			v->poolFullWarned = true;
+			break;
+		}
+		if (v->slotPage[slot] >= 0) {
+			v->pageSlot[v->slotPage[slot]] = -1;
+			evicted.push_back(v->slotPage[slot]);
+		}
+		v->slotPage[slot] = requested[r];
+		v->pageSlot[requested[r]] = slot;
+		v->slotUsed[slot] = v->frame;
+		loads.push_back(requested[r]);
+		loadSlots.push_back(slot);
+	}
+	v->missing = (int)(requested.size() - loads.size());
+	for (size_t r = 0; r < requested.size(); r++) v->pageRequests[requested[r]] = 0;
+	if (loads.empty()) return 0;
+
+	// read the pages on all cores, then upload them one after another
+	std::vector<unsigned char> staging(loads.size() * v->slotBytes);
+	int threads = std::min((int)std::thread::hardware_concurrency(), (int)loads.size());
+	if (threads < 1) threads = 1;
+	std::vector<std::thread> workers;
+	for (int t = 0; t < threads; t++) {
+		workers.push_back(std::thread([&, t] {
+			for (size_t i = t; i < loads.size(); i += threads) copyPage(v, loads[i], staging.data() + i * v->slotBytes);
+		}));
+	}
+	for (int t = 0; t < threads; t++) {
+		workers[t].join();
+	}
+
+	GLenum internalFormat, format, pixelType;
+	volumeTextureFormat(v->desc.type, &internalFormat, &format, &pixelType);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+	glActiveTexture(GL_TEXTURE0 + UNIT_VOLUME);
+	glBindTexture(GL_TEXTURE_3D, v->poolTex);
+	for (size_t i = 0; i < loads.size(); i++) {
+		int s[3];
+		slotCoordinates(v, loadSlots[i], s);
+		glTexSubImage3D(GL_TEXTURE_3D, 0, s[0] * PAGE_STORAGE, s[1] * PAGE_STORAGE, s[2] * PAGE_STORAGE,
+			PAGE_STORAGE, PAGE_STORAGE, PAGE_STORAGE, format, pixelType, staging.data() + i * v->slotBytes);
+	}
+
+	glActiveTexture(GL_TEXTURE0 + UNIT_PAGE_TABLE);
+	glBindTexture(GL_TEXTURE_3D, v->pageTableTex);
+	const unsigned char missing[4] = { 0, 0, 0, 0 };
+	for (size_t i = 0; i < evicted.size(); i++) {
+		setPageEntry(v, evicted[i], missing);
+	}
+	for (size_t i = 0; i < loads.size(); i++) {
+		int s[3];
+		slotCoordinates(v, loadSlots[i], s);
+		unsigned char entry[4] = { (unsigned char)s[0], (unsigned char)s[1], (unsigned char)s[2], 1 };
+		setPageEntry(v, loads[i], entry);
+	}
+	glActiveTexture(GL_TEXTURE0);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+
+	v->pagesLoaded += loads.size();
+	return (int)loads.size();
+}
@@ -0,0 +1,87 @@
+// pagedvolume.h: out-of-core volumes paged into a fixed-size brick pool
+//
+// A volume too large for one 3D texture is split into PAGE_SIZE^3 voxel
+// pages. Only the pages the view needs live on the GPU, in the slots of a
+// pool texture whose size is fixed when the volume loads, each slot holding
+// its page plus a one voxel apron so that trilinear filtering never reads
+// across a slot. A page table texture gives the slot of every resident page;
+// the raycaster looks every sample up through it.
+//
+// Which pages the view needs comes from visibility feedback: a reduced
+// resolution pass of the raycaster writes, per ray, the first page it found
+// missing or else one of the pages it used. The pass is read back
+// asynchronously and evaluated at the start of the next frame, which loads
+// the missing pages from the file mapping into free or least recently used
+// slots.
+//
+//////////////////////////////////////////////////////////////////////
+
+#ifndef PAGEDVOLUME_H
+#define PAGEDVOLUME_H
+
+#include <vector>
+
+#include <GL/glew.h>
+
+#include "volumefile.h"
+
+#define PAGE_SIZE 64						// voxels of a page along each axis, must match volumeRendering.frag
+#define PAGE_STORAGE (PAGE_SIZE + 2)		// a pool slot: the page and its apron
+#define FEEDBACK_SCALE 4					// the feedback pass is this many times smaller than the window
+#define PAGE_PROTECTION_FRAMES 4			// pages used this recently are not evicted
+
+struct PagedVolume
+{
+	VolumeDesc desc;
+	VolumeSource src;					// stays open while the volume is shown
+
+	int pages[3];						// pages along x, y, z
+	int slots[3];						// slots of the pool along x, y, z
+	int slotCount;
+	size_t slotBytes;					// texels of a slot, as uploaded
+
+	GLuint poolTex;						// R8, R16 or R16F like a whole volume would be
+	GLuint pageTableTex;				// RGBA8UI: slot, alpha 1 if resident
+
+	std::vector<int> pageSlot;			// slot of every page, -1 if not resident
+	std::vector<int> slotPage;			// page in every slot, -1 if free
+	std::vector<unsigned int> slotUsed;	// frame the slot's page was last seen in the feedback
+	std::vector<unsigned int> pageRequests;	// pixels that asked for a page in the last feedback
+	unsigned int frame;
+
+	// visibility feedback target and the pixel-pack buffer it is read into
+	GLuint feedbackFramebuffer, feedbackTex, feedbackBuffer;
+	int feedbackWidth, feedbackHeight;
+	bool feedbackPending;				// a readback is waiting for updateResidency
+	GLint previousFramebuffer, previousViewport[4];
+
+	int maxLoadsPerFrame;
+	int resident, missing;				// after the last update
+	size_t pagesLoaded;					// since the volume was loaded
+	bool poolFullWarned;
+};
+
+// Splits the volume into pages and creates the pool, at most poolBytes large
+// but never larger than the whole volume, and the page table. src must stay
+// open; it is closed by destroyPagedVolume. The pool is bound to unit 0 and
+// the page table to unit 8 afterwards.
+bool createPagedVolume(const VolumeDesc *desc, const VolumeSource *src, size_t poolBytes, PagedVolume *volume);
+void destroyPagedVolume(PagedVolume *volume);
+
+// GPU memory of the pool and the page table.
+size_t pagedVolumeBytes(const PagedVolume *volume);
+
+// Binds the feedback target for a window of width x height, with its
+// viewport, and clears it; the raycaster compiled with VISIBILITY_FEEDBACK
+// draws into it next.
+void beginVisibilityFeedback(PagedVolume *volume, int width, int height);
+
+// Starts the readback of the feedback and restores the framebuffer and viewport.
+void endVisibilityFeedback(PagedVolume *volume);
+
+// Evaluates the feedback read back since the last call, if any: marks the
+// pages it saw in use and loads up to maxLoadsPerFrame of the requested
+// pages, the most requested first. Returns the number of pages loaded.
+int updateResidency(PagedVolume *volume);
+
+#endif
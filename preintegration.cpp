@@ -0,0 +1,61 @@
+// preintegration.cpp
+//
+// Pre-integrated transfer function table
+//
+//////////////////////////////////////////////////////////////////////
+
+#include <math.h>
+
+#include "preintegration.h"
+
+#define N PREINTEGRATION_TABLE_SIZE
+
+
+void computePreintegrationTable(const float *transferFunction, float step, float *table)
+{
+	// extinction coefficient (per unit length) and extinction-weighted colour of every entry
+	double extinction[N], weightedColor[N][3];
+	for (int i = 0; i < N; i++) {
+		double alpha = pow(transferFunction[i * 4 + 3], 5);
+		if (alpha > 0.999999) alpha = 0.999999;
+		extinction[i] = -log(1 - alpha) / PREINTEGRATION_REFERENCE_STEP;
+		for (int c = 0; c < 3; c++) {
+			weightedColor[i][c] = extinction[i] * transferFunction[i * 4 + c];
+		}
+	}
+
+	// integrals of both over the scalar value s = (0~N), up to the centre of
+	// every entry; entry i covers [i, i+1) since the lookup is nearest
+	double tauIntegral[N], colorIntegral[N][3];
+	double tauSum = 0, colorSum[3] = { 0, 0, 0 };
+	for (int i = 0; i < N; i++) {
+		tauIntegral[i] = tauSum + 0.5 * extinction[i];
+		tauSum += extinction[i];
+		for (int c = 0; c < 3; c++) {
+			colorIntegral[i][c] = colorSum[c] + 0.5 * weightedColor[i][c];
+			colorSum[c] += weightedColor[i][c];
+		}
+	}
+
+	for (int back = 0; back < N; back++)
+	for (int front = 0; front < N; front++) {
+		// average over the scalar range of the segment, times its length
+		double tau, color[3];
+		if (front == back) {
+			tau = extinction[front];
+			for (int c = 0; c < 3; c++) color[c] = weightedColor[front][c];
+		}
+		else {
+			double ds = back - front;
+			tau = (tauIntegral[back] - tauIntegral[front]) / ds;
+			for (int c = 0; c < 3; c++) color[c] = (colorIntegral[back][c] - colorIntegral[front][c]) / ds;
+		}
+
+		double alpha = 1 - exp(-tau * step);
+		float *entry = table + ((size_t)back * N + front) * 4;
+		for (int c = 0; c < 3; c++) {
+			entry[c] = tau > 0 ? (float)(color[c] / tau * alpha) : 0.0f;
+		}
+		entry[3] = (float)alpha;
+	}
+}
@@ -0,0 +1,31 @@
+// preintegration.h: pre-integrated transfer function table
+//
+// Instead of classifying single samples, the ray is split into segments
+// between two consecutive samples and the colour and opacity of every
+// segment are looked up in a 256x256 table indexed by the scalar values at
+// its front and back. The table integrates the transfer function over the
+// whole scalar range in between (assuming the scalar varies linearly along
+// the segment), so thin features that fall between two samples are not lost
+// and much larger step sizes give the same image.
+//
+// The opacities of the transfer function are interpreted the way the plain
+// compositing shader does: opacity^5 is the opacity of a segment of length
+// PREINTEGRATION_REFERENCE_STEP.
+//
+//////////////////////////////////////////////////////////////////////
+
+#ifndef PREINTEGRATION_H
+#define PREINTEGRATION_H
+
+#define PREINTEGRATION_TABLE_SIZE 256
+
+// step size the transfer function opacities are defined for
+#define PREINTEGRATION_REFERENCE_STEP 0.001f
+
+// Fills table[back][front][4] (premultiplied RGB, alpha) for segments of the
+// given length from transferFunction[256*4] (RGBA, looked up by nearest
+// entry like the 1D transfer function texture). Self-attenuation inside a
+// segment is ignored, the colour is the extinction-weighted average.
+void computePreintegrationTable(const float *transferFunction, float step, float *table);
+
+#endif
@@ -0,0 +1,154 @@
+// progressive.cpp
+//
+// Progressive refinement: reduced resolution levels and jittered accumulation
+//
+//////////////////////////////////////////////////////////////////////
+
+#include <stdio.h>
+
+#include "progressive.h"
+#include "textfile.h"
+#include "textureunits.h"
+
+
+static void createTarget(ProgressiveTarget *target, int width, int height, GLenum internalFormat)
+{
+	target->width = width;
+	target->height = height;
+
+	// on the pass's own unit, the raycaster's bindings stay untouched
+	glActiveTexture(GL_TEXTURE0 + UNIT_PROGRESSIVE);
+	glGenTextures(1, &target->color);
+	glBindTexture(GL_TEXTURE_2D, target->color);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glTexImage2D(GL_TEXTURE_2D, 0, internalFormat, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+	glBindTexture(GL_TEXTURE_2D, 0);
+	glActiveTexture(GL_TEXTURE0);
+
+	glGenFramebuffers(1, &target->framebuffer);
+	glBindFramebuffer(GL_FRAMEBUFFER, target->framebuffer);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, target->color, 0);
+	if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+		printf("Progressive refinement framebuffer is incomplete\n");
+	}
+}
+
+static void destroyTarget(ProgressiveTarget *target)
+{
+	if (!target->framebuffer) return;
+	glDeleteFramebuffers(1, &target->framebuffer);
+	glDeleteTextures(1, &target->color);
+	target->framebuffer = target->color = 0;
+}
+
+// Radical inverse in base b, for the Halton jitter sequence
+static float radicalInverse(int i, int b)
+{
+	float f = 1, r = 0;
+	while (i > 0) {
+		f /= b;
+		r += f * (i % b);
+		i /= b;
+	}
+	return r;
+}
+
+
+void initProgressiveRenderer(ProgressiveRenderer *r)
+{
+	r->width = r->height = 0;
+	for (int i = 0; i < PROGRESSIVE_LEVELS; i++) r->levels[i].framebuffer = r->levels[i].color = 0;
+	r->accumulation.framebuffer = r->accumulation.color = 0;
+	r->step = 0;
+	r->previousFramebuffer = 0;
+
+	r->program = createGLSLProgram("../progressive.vert", NULL, "../progressive.frag");
+	glUseProgram(r->program);
+	glUniform1i(glGetUniformLocation(r->program, "frame"), UNIT_PROGRESSIVE);	// the others belong to the raycaster
+	glUseProgram(0);
+
+	// the pass makes its vertices from gl_VertexID, but core GL wants a VAO bound
+	glGenVertexArrays(1, &r->vertexArray);
+}
+
+void restartProgressive(ProgressiveRenderer *r)
+{
+	r->step = 0;
+}
+
+bool progressiveDone(const ProgressiveRenderer *r)
+{
+	return r->step >= PROGRESSIVE_LEVELS - 1 + PROGRESSIVE_MAX_SAMPLES;
+}
+
+void beginProgressiveStep(ProgressiveRenderer *r, int width, int height, float jitter[2])
+{
+	if (r->width != width || r->height != height) {
+		for (int i = 0; i < PROGRESSIVE_LEVELS; i++) {
+			int divisor = 1 << (PROGRESSIVE_LEVELS - 1 - i);
+			int w = (width + divisor - 1) / divisor, h = (height + divisor - 1) / divisor;
+			destroyTarget(&r->levels[i]);
+			createTarget(&r->levels[i], w, h, GL_RGBA8);
+		}
+		destroyTarget(&r->accumulation);
+		createTarget(&r->accumulation, width, height, GL_RGBA32F);
+		r->width = width;
+		r->height = height;
+		r->step = 0;
+	}
+	// redrawn without new input (e.g. exposed): accumulate again from the full frame
+	if (progressiveDone(r)) r->step = PROGRESSIVE_LEVELS - 1;
+
+	// the sample of step PROGRESSIVE_LEVELS - 1 is the unjittered full frame
+	int level = r->step < PROGRESSIVE_LEVELS ? r->step : PROGRESSIVE_LEVELS - 1;
+	int sample = r->step - (PROGRESSIVE_LEVELS - 1);
+	jitter[0] = sample > 0 ? radicalInverse(sample, 2) - 0.5f : 0;
+	jitter[1] = sample > 0 ? radicalInverse(sample, 3) - 0.5f : 0;
+
+	glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &r->previousFramebuffer);
+	glBindFramebuffer(GL_FRAMEBUFFER, r->levels[level].framebuffer);
+	glViewport(0, 0, r->levels[level].width, r->levels[level].height);
+}
+
+int progressiveSample(const ProgressiveRenderer *r)
+{
+	int sample = r->step - (PROGRESSIVE_LEVELS - 1);
+	return sample > 0 ? sample : 0;
+}
+
+void endProgressiveStep(ProgressiveRenderer *r)
+{
+	int level = r->step < PROGRESSIVE_LEVELS ? r->step : PROGRESSIVE_LEVELS - 1;
+	int sample = r->step - (PROGRESSIVE_LEVELS - 1);
+	const ProgressiveTarget *source = &r->levels[level];
+
+	if (sample >= 0) {
+		// running mean: the new sample weighs 1 / (samples so far + 1)
+		glBindFramebuffer(GL_FRAMEBUFFER, r->accumulation.framebuffer);
+		glViewport(0, 0, r->width, r->height);
+		glBlendFunc(GL_CONSTANT_ALPHA, GL_ONE_MINUS_CONSTANT_ALPHA);
+		glBlendColor(0, 0, 0, 1.0f / (sample + 1));
+		glUseProgram(r->program);
+		glActiveTexture(GL_TEXTURE0 + UNIT_PROGRESSIVE);
+		glBindTexture(GL_TEXTURE_2D, source->color);
+		glActiveTexture(GL_TEXTURE0);
+		glBindVertexArray(r->vertexArray);
+		glDrawArrays(GL_TRIANGLES, 0, 3);
+		glBindVertexArray(0);
+		glUseProgram(0);
+		glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+		source = &r->accumulation;
+	}
+
+	glBindFramebuffer(GL_READ_FRAMEBUFFER, source->framebuffer);
+	glBindFramebuffer(GL_DRAW_FRAMEBUFFER, r->previousFramebuffer);
+	glBlitFramebuffer(0, 0, source->width, source->height, 0, 0, r->width, r->height,
+		GL_COLOR_BUFFER_BIT, source->width == r->width ? GL_NEAREST : GL_LINEAR);
+	glBindFramebuffer(GL_FRAMEBUFFER, r->previousFramebuffer);
+	glViewport(0, 0, r->width, r->height);
+
+	if (!progressiveDone(r)) r->step++;
+}
@@ -0,0 +1,12 @@
+#version 330 core
+
+// copies a frame of the same size; blending weighs it into the accumulation
+
+uniform sampler2D frame;
+
+out vec4 fragColor;
+
+void main()
+{
+    fragColor = texelFetch(frame, ivec2(gl_FragCoord.xy), 0);
+}
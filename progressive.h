@@ -0,0 +1,63 @@
+// progressive.h: progressive refinement of the interactive view
+//
+// While the view is dragged only a quarter resolution image is raycast into
+// a framebuffer object and stretched over the window. Once the motion stops
+// the following idle frames refine it: half resolution, full resolution,
+// then full resolution frames with sub-pixel jitter whose running mean is
+// kept in a float accumulation buffer, which antialiases the silhouettes
+// and the sampling pattern of the rays. Restarting (on any new input)
+// drops back to the quarter resolution at once.
+//
+//////////////////////////////////////////////////////////////////////
+
+#ifndef PROGRESSIVE_H
+#define PROGRESSIVE_H
+
+#include <GL/glew.h>
+
+#define PROGRESSIVE_LEVELS 3			// 1/4, 1/2 and full resolution
+#define PROGRESSIVE_MAX_SAMPLES 16		// full resolution frames averaged, the first unjittered
+
+struct ProgressiveTarget
+{
+	int width, height;
+	GLuint framebuffer, color;			// color is a texture
+};
+
+struct ProgressiveRenderer
+{
+	int width, height;					// window size the targets were made for
+	ProgressiveTarget levels[PROGRESSIVE_LEVELS];
+	ProgressiveTarget accumulation;		// RGBA32F running mean of the samples
+
+	// full-screen pass blending a level into the accumulation buffer
+	GLuint program, vertexArray;
+
+	int step;							// next step: levels first, then samples
+	GLint previousFramebuffer;			// draw target to resolve into
+};
+
+// Creates the accumulation pass; the targets follow the window size lazily.
+void initProgressiveRenderer(ProgressiveRenderer *r);
+
+// The next step starts over at the lowest resolution.
+void restartProgressive(ProgressiveRenderer *r);
+
+// True once all samples have been accumulated.
+bool progressiveDone(const ProgressiveRenderer *r);
+
+// Binds the target of the current step and sets its viewport, for a window
+// of width x height. jitter[2] receives the sub-pixel offset (in pixels) the
+// frame should be rendered with.
+void beginProgressiveStep(ProgressiveRenderer *r, int width, int height, float jitter[2]);
+
+// Index of the accumulated frame the current step renders (0 for the
+// reduced resolution levels and the first full frame), to vary any other
+// per-frame pattern along with the sub-pixel jitter.
+int progressiveSample(const ProgressiveRenderer *r);
+
+// Shows the step in the framebuffer bound before beginProgressiveStep,
+// upscaled or accumulated, restores the viewport and moves to the next step.
+void endProgressiveStep(ProgressiveRenderer *r);
+
+#endif
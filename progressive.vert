@@ -0,0 +1,9 @@
+#version 330 core
+
+// one triangle covering the viewport, made from gl_VertexID alone
+
+void main()
+{
+    vec2 corner = vec2((gl_VertexID << 1) & 2, gl_VertexID & 2);
+    gl_Position = vec4(corner * 2.0 - 1.0, 0.0, 1.0);
+}
@@ -0,0 +1,171 @@
+// pyramid.cpp
+//
+// Multithreaded box and Gaussian downsampling of volume pyramids
+//
+//////////////////////////////////////////////////////////////////////
+
+#include <string.h>
+
+#include <algorithm>
+#include <thread>
+
+#include "pyramid.h"
+
+
+bool parsePyramidFilter(const char *name, PyramidFilter *filter)
+{
+	if (strcmp(name, "box") == 0) *filter = PYRAMID_BOX;
+	else if (strcmp(name, "gaussian") == 0) *filter = PYRAMID_GAUSSIAN;
+	else return false;
+	return true;
+}
+
+const char *pyramidFilterName(PyramidFilter filter)
+{
+	return filter == PYRAMID_GAUSSIAN ? "gaussian" : "box";
+}
+
+int pyramidLevelCount(const int dims[3])
+{
+	int largest = std::max(dims[0], std::max(dims[1], dims[2]));
+	int count = 1;
+	while (largest > 1) {
+		largest /= 2;
+		count++;
+	}
+	return count;
+}
+
+
+//
+// Voxel stores in this machine's byte order, the inverse of decodeVoxel
+//
+template <VoxelType type>
+static inline void storeVoxel(unsigned char *p, float v)
+{
+	if (type == VOXEL_FLOAT32) {
+		memcpy(p, &v, 4);
+		return;
+	}
+	v = v < 0 ? 0 : (v > 1 ? 1 : v);
+	if (type == VOXEL_UINT8) {
+		*p = (unsigned char)(v * 255 + 0.5f);
+	}
+	else {
+		unsigned short s = (unsigned short)(v * 65535 + 0.5f);
+		memcpy(p, &s, 2);
+	}
+}
+
+static inline int clampIndex(int i, int n)
+{
+	return i < 0 ? 0 : (i >= n ? n - 1 : i);
+}
+
+struct LevelSource
+{
+	const unsigned char *data;
+	int dims[3];
+	bool swap;
+};
+
+template <VoxelType inType, VoxelType outType>
+static void downsampleSlices(const LevelSource *src, PyramidFilter filter, PyramidLevel *level, int z0, int z1)
+{
+	static const int boxOffsets[2] = { 0, 1 };
+	static const float boxWeights[2] = { 0.5f, 0.5f };
+	static const int gaussianOffsets[4] = { -1, 0, 1, 2 };
+	static const float gaussianWeights[4] = { 0.125f, 0.375f, 0.375f, 0.125f };
+	const int taps = filter == PYRAMID_GAUSSIAN ? 4 : 2;
+	const int *offsets = filter == PYRAMID_GAUSSIAN ? gaussianOffsets : boxOffsets;
+	const float *weights = filter == PYRAMID_GAUSSIAN ? gaussianWeights : boxWeights;
+
+	const int w = src->dims[0], h = src->dims[1], d = src->dims[2];
+	const int ow = level->dims[0], oh = level->dims[1];
+	const int inSize = voxelSize(inType), outSize = voxelSize(outType);
+
+	// the input rows filtered along x, and the sum over the input slices of the output slice
+	std::vector<float> rows((size_t)h * ow), sum((size_t)ow * oh);
+	for (int oz = z0; oz < z1; oz++) {
+		std::fill(sum.begin(), sum.end(), 0.0f);
+		for (int k = 0; k < taps; k++) {
+			int z = clampIndex(2 * oz + offsets[k], d);
+			for (int y = 0; y < h; y++) {
+				const unsigned char *row = src->data + ((size_t)z * h + y) * w * inSize;
+				for (int ox = 0; ox < ow; ox++) {
+					float v = 0;
+					for (int i = 0; i < taps; i++) {
+						v += weights[i] * decodeVoxel<inType>(row + (size_t)clampIndex(2 * ox + offsets[i], w) * inSize, src->swap);
+					}
+					rows[(size_t)y * ow + ox] = v;
+				}
+			}
+			for (int oy = 0; oy < oh; oy++)
+			for (int j = 0; j < taps; j++) {
+				const float *row = &rows[(size_t)clampIndex(2 * oy + offsets[j], h) * ow];
+				float weight = weights[k] * weights[j];
+				for (int ox = 0; ox < ow; ox++) sum[(size_t)oy * ow + ox] += weight * row[ox];
+			}
+		}
+
+		unsigned char *out = level->voxels.data() + (size_t)oz * oh * ow * outSize;
+		for (size_t i = 0; i < sum.size(); i++) storeVoxel<outType>(out + i * outSize, sum[i]);
+	}
+}
+
+template <VoxelType inType, VoxelType outType>
+static void downsample(const LevelSource *src, PyramidFilter filter, PyramidLevel *level)
+{
+	int threads = (int)std::thread::hardware_concurrency();
+	if (threads > level->dims[2]) threads = level->dims[2];
+	if (threads < 1) threads = 1;
+
+	std::vector<std::thread> workers;
+	for (int t = 0; t < threads; t++) {
+		int z0 = level->dims[2] * t / threads, z1 = level->dims[2] * (t + 1) / threads;
+		workers.push_back(std::thread(downsampleSlices<inType, outType>, src, filter, level, z0, z1));
+	}
+	for (int t = 0; t < threads; t++) {
+		workers[t].join();
+	}
+}
+
+void buildVolumePyramid(const unsigned char *data, const VolumeDesc *desc, PyramidFilter filter, int count,
+	std::vector<PyramidLevel> *levels)
+{
+	// int16 is stored biased like uint16 once loaded
+	VoxelType stored = desc->type == VOXEL_INT16 ? VOXEL_UINT16 : desc->type;
+
+	levels->resize(count > 1 ? count - 1 : 0);
+	LevelSource src;
+	src.data = data;
+	memcpy(src.dims, desc->dims, sizeof(src.dims));
+	src.swap = needsByteSwap(desc);
+
+	for (int l = 0; l < (int)levels->size(); l++) {
+		PyramidLevel *level = &(*levels)[l];
+		for (int i = 0; i < 3; i++) level->dims[i] = std::max(src.dims[i] / 2, 1);
+		level->voxels.resize((size_t)level->dims[0] * level->dims[1] * level->dims[2] * voxelSize(stored));
+
+		if (l == 0) {
+			switch (desc->type) {
+				case VOXEL_UINT16: downsample<VOXEL_UINT16, VOXEL_UINT16>(&src, filter, level); break;
+				case VOXEL_INT16: downsample<VOXEL_INT16, VOXEL_UINT16>(&src, filter, level); break;
+				case VOXEL_FLOAT32: downsample<VOXEL_FLOAT32, VOXEL_FLOAT32>(&src, filter, level); break;
+				default: downsample<VOXEL_UINT8, VOXEL_UINT8>(&src, filter, level); break;
+			}
+		}
+		else {
+			switch (stored) {
+				case VOXEL_UINT16: downsample<VOXEL_UINT16, VOXEL_UINT16>(&src, filter, level); break;
+				case VOXEL_FLOAT32: downsample<VOXEL_FLOAT32, VOXEL_FLOAT32>(&src, filter, level); break;
+				default: downsample<VOXEL_UINT8, VOXEL_UINT8>(&src, filter, level); break;
+			}
+		}
+
+		// the next level reads this one, in host byte order
+		src.data = level->voxels.data();
+		memcpy(src.dims, level->dims, sizeof(src.dims));
+		src.swap = false;
+	}
+}
@@ -0,0 +1,45 @@
+// pyramid.h: multi-resolution pyramid of a volume for level-of-detail sampling
+//
+// Every level halves the one before along each axis (rounding down, at least
+// one voxel, like GL's mip chain), filtered either with a 2x2x2 box or with
+// a 4x4x4 binomial approximation of a Gaussian that suppresses aliasing
+// better. The levels are stored as the mip levels of the volume texture, so
+// the raycaster picks one with textureLod and filters between two.
+//
+// Each level is computed from the one before, separably: along x for each
+// input row, then along y and z. The output slices of a level are split
+// across the hardware threads.
+//
+//////////////////////////////////////////////////////////////////////
+
+#ifndef PYRAMID_H
+#define PYRAMID_H
+
+#include <vector>
+
+#include "volumefile.h"
+
+enum PyramidFilter
+{
+	PYRAMID_BOX,			// mean of the 2x2x2 voxels a coarse voxel covers
+	PYRAMID_GAUSSIAN		// weights 1 3 3 1 along every axis, reaching one voxel further
+};
+
+bool parsePyramidFilter(const char *name, PyramidFilter *filter);
+const char *pyramidFilterName(PyramidFilter filter);
+
+struct PyramidLevel
+{
+	int dims[3];
+	std::vector<unsigned char> voxels;	// 8-bit, unsigned 16-bit or float, as the volume is uploaded
+};
+
+// Levels of the full mip chain of a volume, level 0 included.
+int pyramidLevelCount(const int dims[3]);
+
+// Builds levels 1 to count-1 from the raw voxels of a volume (byte order
+// and int16 bias as described by desc); level 0 is the volume itself.
+void buildVolumePyramid(const unsigned char *data, const VolumeDesc *desc, PyramidFilter filter, int count,
+	std::vector<PyramidLevel> *levels);
+
+#endif
@@ -27,7 +27,7 @@
 #include <GL/glut.h>
 #endif
 
-char *textFileRead(char *fn) {
+char *textFileRead(const char *fn) {
 
 
 	FILE *fp;
@@ -74,12 +74,29 @@ int textFileWrite(char *fn, char *s) {
 }
 
 
-GLuint loadShader(GLenum shadertype, char *c)
+GLuint loadShader(GLenum shadertype, const char *c, const char *defines)
 {
 	GLuint s = glCreateShader( shadertype );
 	char *ss = textFileRead( c );
-	const char *css = ss;
-	glShaderSource(s, 1, &css, NULL);
+	assert( ss );
+
+	// the #version line has to stay first, the defines go right behind it
+	const char *body = ss;
+	int versionLength = 0;
+	if( strncmp( ss, "#version", 8 ) == 0 )
+	{
+		body = strchr( ss, '\n' );
+		body = body ? body + 1 : ss + strlen( ss );
+		versionLength = (int)(body - ss);
+	}
+
+	// restore the line numbering of the file for compiler messages
+	char line[32];
+	sprintf( line, "\n#line %d\n", versionLength ? 2 : 1 );
+
+	const char *css[4] = { ss, defines ? defines : "", line, body };
+	GLint lengths[4] = { versionLength, -1, -1, -1 };
+	glShaderSource(s, 4, css, lengths);
 	free( ss );
 	glCompileShader( s );
 
@@ -99,7 +116,7 @@ GLuint loadShader(GLenum shadertype, char *c)
 	return s;
 }
 
-GLuint createGLSLProgram(char *vs, char *gs, char *fs) 
+GLuint createGLSLProgram(const char *vs, const char *gs, const char *fs, const char *defines) 
 {
 	GLuint v, g, f, p;
 	
@@ -109,17 +126,17 @@ GLuint createGLSLProgram(char *vs, char *gs, char *fs)
 	
 	if( vs ) 
 	{
-		v = loadShader( GL_VERTEX_SHADER, vs );
+		v = loadShader( GL_VERTEX_SHADER, vs, defines );
 		glAttachShader(p,v);
 	}
 	if( gs )
 	{
-		g = loadShader( GL_GEOMETRY_SHADER_EXT, gs );
+		g = loadShader( GL_GEOMETRY_SHADER_EXT, gs, defines );
 		glAttachShader(p,g);
 	}
 	if( fs )
 	{
-		f = loadShader( GL_FRAGMENT_SHADER, fs );
+		f = loadShader( GL_FRAGMENT_SHADER, fs, defines );
 		glAttachShader(p,f);
 	}
 
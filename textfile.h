@@ -9,6 +9,8 @@
 //
 //////////////////////////////////////////////////////////////////////
 
-char *textFileRead(char *fn);
+char *textFileRead(const char *fn);
 int textFileWrite(char *fn, char *s);
-GLuint createGLSLProgram(char *vs=NULL, char *gs=NULL, char *fs=NULL);
\ No newline at end of file
+// defines (e.g. "#define RENDER_MODE 1\n") is inserted right after the
+// #version line of every stage, so one source yields specialized programs
+GLuint createGLSLProgram(const char *vs=NULL, const char *gs=NULL, const char *fs=NULL, const char *defines=NULL);
\ No newline at end of file
@@ -0,0 +1,23 @@
+// textureunits.h: texture units shared by the raycaster and its passes
+//
+// The samplers of every raycasting program are bound once to these units,
+// so the other passes (progressive refinement, page streaming) keep off
+// them or reuse one whose target the raycaster leaves free. Units are
+// indices: bind with glActiveTexture(GL_TEXTURE0 + unit).
+//
+//////////////////////////////////////////////////////////////////////
+
+#ifndef TEXTUREUNITS_H
+#define TEXTUREUNITS_H
+
+#define UNIT_VOLUME 0					// 3D: the volume, or the page pool when paging
+#define UNIT_TRANSFER_FUNCTION 1		// 1D
+#define UNIT_OCCUPANCY 2				// 3D: empty space of the bricks
+#define UNIT_PREINTEGRATION 3			// 2D
+#define UNIT_BLUE_NOISE 4				// 2D: ray start jitter
+#define UNIT_PROGRESSIVE 5				// 2D: level blended by the progressive pass
+#define UNIT_GRADIENTS 6				// 3D
+#define UNIT_VALUE_RANGE 7				// 3D: min/max of the bricks
+#define UNIT_PAGE_TABLE 8				// 3D page table; the 2D feedback texture is made here
+
+#endif
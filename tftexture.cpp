@@ -0,0 +1,140 @@
+// tftexture.cpp
+//
+// Transfer function texture with dirty-range uploads
+//
+//////////////////////////////////////////////////////////////////////
+
+#include <string.h>
+
+#include "tftexture.h"
+
+
+static const struct
+{
+	const char *name;
+	GLenum internalFormat;
+	GLenum type;
+	int bytesPerEntry;
+} formats[] = {
+	{ "rgba8", GL_RGBA8, GL_UNSIGNED_BYTE, 4 },
+	{ "rgba16f", GL_RGBA16F, GL_HALF_FLOAT, 8 },
+	{ "rgba32f", GL_RGBA32F, GL_FLOAT, 16 },
+};
+
+bool parseTransferFunctionFormat(const char *name, TransferFunctionFormat *format)
+{
+	for (int i = 0; i < 3; i++) {
+		if (strcmp(name, formats[i].name) == 0) {
+			*format = (TransferFunctionFormat)i;
+			return true;
+		}
+	}
+	return false;
+}
+
+const char *transferFunctionFormatName(TransferFunctionFormat format)
+{
+	return formats[format].name;
+}
+
+
+//
+// Conversion to the texel formats, rounding like the GL would
+//
+static inline unsigned char toUnorm8(float v)
+{
+	v = v < 0 ? 0 : (v > 1 ? 1 : v);
+	return (unsigned char)(v * 255 + 0.5f);
+}
+
+static unsigned short toHalf(float v)
+{
+	unsigned int bits;
+	memcpy(&bits, &v, 4);
+	unsigned int sign = (bits >> 16) & 0x8000;
+	int exponent = (int)((bits >> 23) & 0xff) - 127 + 15;
+	unsigned int mantissa = bits & 0x7fffff;
+
+	if (exponent <= 0) {
+		// subnormal half, or zero
+		if (exponent < -10) return (unsigned short)sign;
+		mantissa |= 0x800000;
+		int shift = 14 - exponent;
+		return (unsigned short)(sign | ((mantissa + (1u << (shift - 1))) >> shift));
+	}
+	if (exponent >= 31) return (unsigned short)(sign | 0x7c00);
+
+	// a carry out of the mantissa correctly bumps the exponent
+	unsigned int half = ((unsigned int)exponent << 10) | (mantissa >> 13);
+	return (unsigned short)(sign | (half + ((mantissa >> 12) & 1)));
+}
+
+// Uploads entries first..last of table into the bound texture.
+static size_t uploadRange(TransferFunctionFormat format, const float *table, int first, int last)
+{
+	int count = last - first + 1;
+	const float *src = table + first * 4;
+	unsigned char bytes[TRANSFER_FUNCTION_SIZE * 4];
+	unsigned short halves[TRANSFER_FUNCTION_SIZE * 4];
+	const void *pixels = src;
+
+	if (format == TF_FORMAT_RGBA8) {
+		for (int i = 0; i < count * 4; i++) bytes[i] = toUnorm8(src[i]);
+		pixels = bytes;
+	}
+	else if (format == TF_FORMAT_RGBA16F) {
+		for (int i = 0; i < count * 4; i++) halves[i] = toHalf(src[i]);
+		pixels = halves;
+	}
+
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+	glTexSubImage1D(GL_TEXTURE_1D, 0, first, count, GL_RGBA, formats[format].type, pixels);
+	return (size_t)count * formats[format].bytesPerEntry;
+}
+
+
+void createTransferFunctionTexture(TransferFunctionTexture *tex, TransferFunctionFormat format, const float *table)
+{
+	tex->format = format;
+	tex->dirtyFirst = TRANSFER_FUNCTION_SIZE;
+	tex->dirtyLast = -1;
+	tex->lastBytes = tex->totalBytes = 0;
+	tex->uploads = 0;
+	memcpy(tex->uploaded, table, sizeof(tex->uploaded));
+
+	glGenTextures(1, &tex->id);
+	glBindTexture(GL_TEXTURE_1D, tex->id);
+	glTexParameteri(GL_TEXTURE_1D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_1D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_1D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexImage1D(GL_TEXTURE_1D, 0, formats[format].internalFormat, TRANSFER_FUNCTION_SIZE, 0, GL_RGBA, GL_FLOAT, NULL);
+	uploadRange(format, table, 0, TRANSFER_FUNCTION_SIZE - 1);
+}
+
+void markTransferFunctionDirty(TransferFunctionTexture *tex, int first, int last)
+{
+	if (first < 0) first = 0;
+	if (last > TRANSFER_FUNCTION_SIZE - 1) last = TRANSFER_FUNCTION_SIZE - 1;
+	if (first < tex->dirtyFirst) tex->dirtyFirst = first;
+	if (last > tex->dirtyLast) tex->dirtyLast = last;
+}
+
+size_t updateTransferFunctionTexture(TransferFunctionTexture *tex, const float *table)
+{
+	int first = tex->dirtyFirst, last = tex->dirtyLast;
+	tex->dirtyFirst = TRANSFER_FUNCTION_SIZE;
+	tex->dirtyLast = -1;
+	tex->lastBytes = 0;
+
+	// trim the marked range down to the entries whose values differ
+	while (first <= last && memcmp(table + first * 4, tex->uploaded + first * 4, 4 * sizeof(float)) == 0) first++;
+	while (last >= first && memcmp(table + last * 4, tex->uploaded + last * 4, 4 * sizeof(float)) == 0) last--;
+	if (first > last) return 0;
+
+	memcpy(tex->uploaded + first * 4, table + first * 4, (last - first + 1) * 4 * sizeof(float));
+	glBindTexture(GL_TEXTURE_1D, tex->id);
+	tex->lastBytes = uploadRange(tex->format, table, first, last);
+	tex->totalBytes += tex->lastBytes;
+	tex->uploads++;
+	return tex->lastBytes;
+}
@@ -0,0 +1,53 @@
+// tftexture.h: the transfer function texture and its incremental updates
+//
+// The texture keeps a copy of the entries it holds. Editors mark the range
+// of entries they have touched; an update compares that range against the
+// copy, uploads only the span that really differs, converted to the format
+// of the texture, and makes no GL call at all when nothing has changed.
+// The bytes sent are counted for the frame statistics.
+//
+//////////////////////////////////////////////////////////////////////
+
+#ifndef TFTEXTURE_H
+#define TFTEXTURE_H
+
+#include <GL/glew.h>
+
+#include <stddef.h>
+
+#define TRANSFER_FUNCTION_SIZE 256
+
+enum TransferFunctionFormat
+{
+	TF_FORMAT_RGBA8,			// what the CPU raycaster assumes too
+	TF_FORMAT_RGBA16F,
+	TF_FORMAT_RGBA32F
+};
+
+struct TransferFunctionTexture
+{
+	GLuint id;
+	TransferFunctionFormat format;
+	float uploaded[TRANSFER_FUNCTION_SIZE * 4];	// entries as last sent
+	int dirtyFirst, dirtyLast;					// marked entries, none if first > last
+	size_t lastBytes;							// sent by the last update
+	size_t totalBytes;
+	int uploads;
+};
+
+// Parses "rgba8", "rgba16f" or "rgba32f".
+bool parseTransferFunctionFormat(const char *name, TransferFunctionFormat *format);
+const char *transferFunctionFormatName(TransferFunctionFormat format);
+
+// Creates the 1D texture (nearest filtering, clamped) holding table[256*4]
+// on the active texture unit.
+void createTransferFunctionTexture(TransferFunctionTexture *tex, TransferFunctionFormat format, const float *table);
+
+// Entries first..last (inclusive) of the table may have changed.
+void markTransferFunctionDirty(TransferFunctionTexture *tex, int first, int last);
+
+// Sends the marked entries of table that differ from the texture, binding
+// it on the active texture unit if so. Returns the number of bytes uploaded.
+size_t updateTransferFunctionTexture(TransferFunctionTexture *tex, const float *table);
+
+#endif
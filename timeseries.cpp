@@ -0,0 +1,614 @@
+// timeseries.cpp
+//
+// Ring of time step textures filled by a background I/O thread through
+// pixel-unpack buffers, and the playback clock over it
+//
+//////////////////////////////////////////////////////////////////////
+
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+
+#include <algorithm>
+
+#include "timeseries.h"
+#include "volumeupload.h"
+#include "histogram.h"
+#include "textureunits.h"
+
+// bytes converted and counted at a time, small enough to stay in the cache
+#define SLAB_BYTES (4 << 20)
+
+// polling interval of updateTimeSeries while a read is in flight
+#define READ_POLL_MS 5
+
+
+static bool fileExists(const char *filename)
+{
+	FILE *f = fopen(filename, "rb");
+	if (f == NULL) return false;
+	fclose(f);
+	return true;
+}
+
+static int firstStepNumber(const char *pattern)
+{
+	char filename[1024];
+	for (int n = 0; n <= 1; n++) {
+		snprintf(filename, sizeof(filename), pattern, n);
+		if (fileExists(filename)) return n;
+	}
+	return -1;
+}
+
+bool firstTimeStepFile(const char *pattern, char *filename, size_t size)
+{
+	int first = firstStepNumber(pattern);
+	if (first < 0) return false;
+	snprintf(filename, size, pattern, first);
+	return true;
+}
+
+bool findTimeSteps(const char *pattern, const VolumeDesc *first, std::vector<VolumeDesc> *steps)
+{
+	steps->clear();
+	int n = firstStepNumber(pattern);
+	if (n < 0) {
+		printf("No time step matches %s\n", pattern);
+		return false;
+	}
+
+	char filename[1024];
+	for (;; n++) {
+		snprintf(filename, sizeof(filename), pattern, n);
+		if (!fileExists(filename)) break;
+
+		VolumeDesc step = *first;
+		VolumeDesc parsed;
+		if (parseVolumeDesc(filename, &parsed)) {
+			if (memcmp(parsed.dims, first->dims, sizeof(parsed.dims)) != 0 || (parsed.compressed && parsed.type != first->type)) {
+				printf("Time step %s is %dx%dx%d %s, the first one %dx%dx%d %s\n", filename,
+					parsed.dims[0], parsed.dims[1], parsed.dims[2], voxelTypeName(parsed.type),
+					first->dims[0], first->dims[1], first->dims[2], voxelTypeName(first->type));
+				return false;
+			}
+			memcpy(step.dataFile, parsed.dataFile, sizeof(step.dataFile));
+			step.dataOffset = parsed.dataOffset;
+			step.compressed = parsed.compressed;
+			if (parsed.compressed) step.bigEndian = parsed.bigEndian;
+		}
+		else {
+			snprintf(step.dataFile, sizeof(step.dataFile), "%s", filename);
+			step.compressed = false;
+		}
+		steps->push_back(step);
+	}
+	return true;
+}
+
+static int stepOf(const TimeSeries *series, long long position)
+{
+	return (int)(position % (long long)series->steps.size());
+}
+
+// how far step is ahead of the clock position, 0 for the step of the position
+static int stepsAhead(const TimeSeries *series, int step)
+{
+	int count = (int)series->steps.size();
+	return (step - stepOf(series, series->position) + count) % count;
+}
+
+// While playing, the steps the clock passes while one step is read are not
+// worth reading any more; the ring covers the steps after them.
+static int leadSteps(const TimeSeries *series)
+{
+	if (!series->playing) return 0;
+	int lead = (int)(series->readAverage * series->rate);
+	return std::min(lead, (int)series->steps.size() - series->slotCount);
+}
+
+static bool inWindow(const TimeSeries *series, int step)
+{
+	return stepsAhead(series, step) < leadSteps(series) + series->slotCount;
+}
+
+static int slotOfStep(const TimeSeries *series, int step)
+{
+	for (int i = 0; i < series->slotCount; i++) {
+		if (series->slots[i].step == step) return i;
+	}
+	return -1;
+}
+
+//
+// I/O thread: read the step of a queued slot into its buffer, converting,
+// counting and building the bricks on the way
+//
+static void readStep(TimeSeries *series, TimeSlot *slot, int step, unsigned char *target, std::vector<unsigned char> *staging)
+{
+	const VolumeDesc *desc = &series->steps[step];
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+	VolumeSource src;
+	if (!openVolumeData(desc, &src)) {
+		slot->failed = true;
+		return;
+	}
+
+	unsigned char *out = target;
+	if (out == NULL) {
+		slot->staging.resize(series->stepBytes);
+		out = slot->staging.data();
+	}
+	bool convert = needsByteSwap(desc) || desc->type == VOXEL_INT16;
+	int size = voxelSize(desc->type);
+
+	// a step read before keeps its histogram
+	std::vector<float> *histogram = &series->histograms[step];
+	bool count = histogram->empty();
+	uint64_t counts[256];
+	memset(counts, 0, sizeof(counts));
+
+	for (size_t offset = 0; offset < series->stepBytes; offset += SLAB_BYTES) {
+		size_t bytes = std::min((size_t)SLAB_BYTES, series->stepBytes - offset);
+		const unsigned char *slab = src.data + offset;
+		if (convert) {
+			convertVoxels(slab, bytes, desc, staging->data());
+			slab = staging->data();
+		}
+		// the mapped buffer is written only; counting reads the cached slab
+		memcpy(out + offset, slab, bytes);
+		if (count) accumulateHistogram(slab, bytes / size, size, 256, counts);
+	}
+	if (count) {
+		double voxels = (double)desc->dims[0] * desc->dims[1] * desc->dims[2];
+		histogram->resize(256);
+		for (int i = 0; i < 256; i++) (*histogram)[i] = (float)(counts[i] / voxels);
+	}
+	std::chrono::steady_clock::time_point read = std::chrono::steady_clock::now();
+	slot->readSeconds = std::chrono::duration<double>(read - start).count();
+
+	buildBrickGrid(src.data, desc, &slot->bricks);
+	slot->brickSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - read).count();
+
+	closeVolumeSource(&src);
+}
+
+static void readSteps(TimeSeries *series)
+{
+	std::vector<unsigned char> staging(SLAB_BYTES);
+	for (;;) {
+		TimeSlot *slot;
+		int step;
+		unsigned char *target;
+		{
+			std::unique_lock<std::mutex> guard(series->lock);
+			series->signal.wait(guard, [&] { return series->quit || !series->requests.empty(); });
+			if (series->quit) return;
+			slot = &series->slots[series->requests.front()];
+			series->requests.pop_front();
+			slot->state = SLOT_READING;
+			step = slot->step;
+			target = slot->target;
+		}
+
+		readStep(series, slot, step, target, &staging);
+
+		{
+			std::lock_guard<std::mutex> guard(series->lock);
+			slot->state = SLOT_READ;
+		}
+		series->signal.notify_all();
+	}
+}
+
+//
+// Render thread
+//
+static void createSlotTexture(const VolumeDesc *desc, GLuint *texture)
+{
+	GLenum internalFormat, format, pixelType;
+	volumeTextureFormat(desc->type, &internalFormat, &format, &pixelType);
+
+	glGenTextures(1, texture);
+	glBindTexture(GL_TEXTURE_3D, *texture);
+	glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAX_LEVEL, 0);
+	if (GLEW_ARB_texture_storage) {
+		glTexStorage3D(GL_TEXTURE_3D, 1, internalFormat, desc->dims[0], desc->dims[1], desc->dims[2]);
+	}
+	else {
+		glTexImage3D(GL_TEXTURE_3D, 0, internalFormat, desc->dims[0], desc->dims[1], desc->dims[2], 0, format, pixelType, NULL);
+	}
+}
+
+// Maps the buffer of a slot and hands it to the I/O thread for step
+static void requestStep(TimeSeries *series, int s, int step)
+{
+	TimeSlot *slot = &series->slots[s];
+
+	// orphan the previous contents so mapping never waits for an upload in flight
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, slot->buffer);
+	glBufferData(GL_PIXEL_UNPACK_BUFFER, series->stepBytes, NULL, GL_STREAM_DRAW);
+	slot->bufferBytes = series->stepBytes;
+	unsigned char *target = (unsigned char *)glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, series->stepBytes,
+		GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+	{
+		std::lock_guard<std::mutex> guard(series->lock);
+		slot->step = step;
+		slot->state = SLOT_QUEUED;
+		slot->target = target;
+		slot->failed = false;
+		series->requests.push_back(s);
+	}
+	series->signal.notify_all();
+}
+
+static void releaseSlot(TimeSlot *slot)
+{
+	if (slot->target) {
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, slot->buffer);
+		glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+		slot->target = NULL;
+	}
+	slot->step = -1;
+	slot->state = SLOT_FREE;
+}
+
+// Uploads the slots the I/O thread has filled. Steps the clock has left
+// behind meanwhile are not uploaded at all.
+static void finishReads(TimeSeries *series)
+{
+	const VolumeDesc *desc = &series->steps[0];
+	GLenum internalFormat, format, pixelType;
+	volumeTextureFormat(desc->type, &internalFormat, &format, &pixelType);
+
+	for (int s = 0; s < series->slotCount; s++) {
+		TimeSlot *slot = &series->slots[s];
+		if (slot->state != SLOT_READ) continue;
+
+		double seconds = slot->readSeconds + slot->brickSeconds;
+		series->readAverage = series->readAverage > 0 ? 0.8 * series->readAverage + 0.2 * seconds : seconds;
+
+		if (slot->failed) {
+			// kept as the step's slot, so that it is not read again while it is ahead
+			printf("Time step %d (%s) could not be read\n", slot->step, series->steps[slot->step].dataFile);
+			int step = slot->step;
+			releaseSlot(slot);
+			slot->step = step;
+			slot->state = SLOT_RESIDENT;
+			continue;
+		}
+		if (!inWindow(series, slot->step)) {
+			releaseSlot(slot);
+			continue;
+		}
+
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		glBindTexture(GL_TEXTURE_3D, slot->texture);
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, slot->buffer);
+		bool unmapped = slot->target && glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+		slot->target = NULL;
+		if (unmapped) {
+			glTexSubImage3D(GL_TEXTURE_3D, 0, 0, 0, 0, desc->dims[0], desc->dims[1], desc->dims[2], format, pixelType, (void *)0);
+			glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+		}
+		else if (!slot->staging.empty()) {
+			// mapping failed: the I/O thread filled the staging copy instead
+			glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+			glTexSubImage3D(GL_TEXTURE_3D, 0, 0, 0, 0, desc->dims[0], desc->dims[1], desc->dims[2], format, pixelType,
+				slot->staging.data());
+			std::vector<unsigned char>().swap(slot->staging);
+		}
+		else {
+			// the buffer got corrupted while mapped: read the step again
+			glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+			glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+			releaseSlot(slot);
+			continue;
+		}
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+
+		slot->state = SLOT_RESIDENT;
+		series->stats.loads++;
+		series->stats.readSeconds += slot->readSeconds;
+		series->stats.brickSeconds += slot->brickSeconds;
+		series->stats.uploadSeconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	}
+}
+
+// The slot to read a step into that is ahead by the given number of steps:
+// a free one, else one whose step the clock has passed, else the one
+// holding the step farthest ahead of it. The slot on screen and slots the
+// I/O thread is busy with are never taken.
+static int findSlot(TimeSeries *series, int ahead)
+{
+	int found = -1, foundAhead = ahead;
+	for (int s = 0; s < series->slotCount; s++) {
+		TimeSlot *slot = &series->slots[s];
+		if (s == series->shownSlot || slot->state == SLOT_READING || slot->state == SLOT_READ) continue;
+		if (slot->state == SLOT_FREE) return s;
+
+		int slotAhead = stepsAhead(series, slot->step);
+		if (!inWindow(series, slot->step)) slotAhead = (int)series->steps.size();
+		if (slotAhead > foundAhead) {
+			found = s;
+			foundAhead = slotAhead;
+		}
+	}
+	return found;
+}
+
+// Queues the reads of the steps from the clock position (plus the lead) on
+// that fit into the ring, nearest first
+static void prefetchSteps(TimeSeries *series)
+{
+	int lead = leadSteps(series);
+	for (int ahead = lead; ahead < lead + series->slotCount; ahead++) {
+		int step = stepOf(series, series->position + ahead);
+		if (slotOfStep(series, step) >= 0) continue;
+
+		int s = findSlot(series, ahead);
+		if (s < 0) break;
+
+		TimeSlot *slot = &series->slots[s];
+		if (slot->state == SLOT_QUEUED) {
+			// take the request back unless the I/O thread has just started on it
+			std::lock_guard<std::mutex> guard(series->lock);
+			if (slot->state != SLOT_QUEUED) break;
+			series->requests.erase(std::find(series->requests.begin(), series->requests.end(), s));
+			slot->state = SLOT_FREE;
+		}
+		releaseSlot(slot);
+		requestStep(series, s, step);
+	}
+}
+
+void createTimeSeries(const std::vector<VolumeDesc> &steps, int ringSize, float rate, GLuint texture,
+	const float histogram[256], const BrickGrid *bricks, TimeSeries *series)
+{
+	series->steps = steps;
+	series->histograms.assign(steps.size(), std::vector<float>());
+	series->histograms[0].assign(histogram, histogram + 256);
+	series->stepBytes = volumeBytes(&steps[0]);
+
+	series->slotCount = std::min(std::max(ringSize, 2), MAX_TIME_SLOTS);
+	series->slotCount = std::min(series->slotCount, (int)steps.size());
+	for (int s = 0; s < series->slotCount; s++) {
+		TimeSlot *slot = &series->slots[s];
+		if (s == 0) slot->texture = texture;
+		else createSlotTexture(&steps[0], &slot->texture);
+		glGenBuffers(1, &slot->buffer);
+		slot->step = -1;
+		slot->state = SLOT_FREE;
+		slot->target = NULL;
+		slot->failed = false;
+		slot->readSeconds = slot->brickSeconds = 0;
+		slot->bufferBytes = 0;
+	}
+	series->slots[0].step = 0;
+	series->slots[0].state = SLOT_RESIDENT;
+	series->slots[0].bricks = *bricks;
+	series->readAverage = 0;
+
+	series->rate = rate;
+	series->playing = false;
+	series->clockStart = series->lastUpdate = std::chrono::steady_clock::now();
+	series->clockPosition = series->position = 0;
+	series->shownSlot = 0;
+	series->positionShown = true;
+	series->positionDrawn = false;
+	series->stats = TimeSeriesStats();
+	series->stats.start = series->clockStart;
+
+	series->requests.clear();
+	series->quit = false;
+	series->io = std::thread(readSteps, series);
+
+	prefetchSteps(series);
+	glBindTexture(GL_TEXTURE_3D, texture);
+
+	printf("Time series: %d steps of %dx%dx%d %s, %d resident at a time, %g steps/s\n", (int)steps.size(),
+		steps[0].dims[0], steps[0].dims[1], steps[0].dims[2], voxelTypeName(steps[0].type), series->slotCount, rate);
+}
+
+void stopTimeSeriesLoader(TimeSeries *series)
+{
+	if (!series->io.joinable()) return;
+	{
+		std::lock_guard<std::mutex> guard(series->lock);
+		series->quit = true;
+	}
+	series->signal.notify_all();
+	series->io.join();
+}
+
+void destroyTimeSeries(TimeSeries *series)
+{
+	stopTimeSeriesLoader(series);
+	for (int s = 0; s < series->slotCount; s++) {
+		TimeSlot *slot = &series->slots[s];
+		releaseSlot(slot);
+		glDeleteBuffers(1, &slot->buffer);
+		glDeleteTextures(1, &slot->texture);
+	}
+	series->slotCount = 0;
+}
+
+// Moves the clock position on and sorts the steps it left into drawn and dropped
+static void advanceClock(TimeSeries *series, long long position)
+{
+	TimeSeriesStats *stats = &series->stats;
+	if (series->positionDrawn) stats->drawn++;
+	else if (series->positionShown) stats->droppedRendering++;
+	else stats->droppedLoading++;
+	stats->passed++;
+
+	// steps skipped over without a single update
+	for (long long p = series->position + 1; p < position; p++) {
+		int s = slotOfStep(series, stepOf(series, p));
+		if (s >= 0 && series->slots[s].state == SLOT_RESIDENT && !series->slots[s].failed) stats->droppedRendering++;
+		else stats->droppedLoading++;
+		stats->passed++;
+	}
+
+	long long count = (long long)series->steps.size();
+	bool looped = position / count != series->position / count;
+	series->position = position;
+	series->positionShown = series->positionDrawn = false;
+	if (looped) printTimeSeriesStats(series);
+}
+
+bool updateTimeSeries(TimeSeries *series)
+{
+	std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+	if (!series->positionShown) {
+		series->stats.lateMs += std::chrono::duration<double, std::milli>(now - series->lastUpdate).count();
+	}
+	series->lastUpdate = now;
+
+	// the uploads bind the slot textures to the volume unit, where the shown one goes back
+	glActiveTexture(GL_TEXTURE0 + UNIT_VOLUME);
+	finishReads(series);
+
+	if (series->playing) {
+		double seconds = std::chrono::duration<double>(now - series->clockStart).count();
+		long long position = series->clockPosition + (long long)floor(seconds * series->rate);
+		if (position > series->position) advanceClock(series, position);
+	}
+
+	bool changed = false;
+	if (!series->positionShown) {
+		int s = slotOfStep(series, stepOf(series, series->position));
+		if (s >= 0 && series->slots[s].state == SLOT_RESIDENT && !series->slots[s].failed) {
+			changed = s != series->shownSlot;
+			series->shownSlot = s;
+			series->positionShown = true;
+		}
+	}
+
+	prefetchSteps(series);
+
+	glBindTexture(GL_TEXTURE_3D, series->slots[series->shownSlot].texture);
+	return changed;
+}
+
+bool waitForTimeStep(TimeSeries *series)
+{
+	bool changed = updateTimeSeries(series);
+	while (!series->positionShown) {
+		int s = slotOfStep(series, stepOf(series, series->position));
+		if (s >= 0 && series->slots[s].state == SLOT_RESIDENT && series->slots[s].failed) break;
+		{
+			std::unique_lock<std::mutex> guard(series->lock);
+			series->signal.wait_for(guard, std::chrono::milliseconds(100), [&] {
+				for (int i = 0; i < series->slotCount; i++) {
+					if (series->slots[i].state == SLOT_READ) return true;
+				}
+				return false;
+			});
+		}
+		changed = updateTimeSeries(series) || changed;
+	}
+	return changed;
+}
+
+void playTimeSeries(TimeSeries *series, bool playing)
+{
+	if (playing && !series->playing) {
+		series->clockStart = std::chrono::steady_clock::now();
+		series->clockPosition = series->position;
+	}
+	series->playing = playing;
+}
+
+void seekTimeSeries(TimeSeries *series, long long position)
+{
+	long long count = (long long)series->steps.size();
+	if (position < 0) position += count * (-position / count + 1);
+
+	series->playing = false;
+	series->position = position;
+	series->lastUpdate = std::chrono::steady_clock::now();
+	series->positionShown = series->slots[series->shownSlot].step == stepOf(series, position);
+	series->positionDrawn = false;
+}
+
+void timeStepDrawn(TimeSeries *series)
+{
+	series->stats.frames++;
+	if (series->positionShown) series->positionDrawn = true;
+}
+
+int timeSeriesWaitMs(const TimeSeries *series)
+{
+	int waitMs = -1;
+	for (int s = 0; s < series->slotCount; s++) {
+		TimeSlotState state = series->slots[s].state;
+		if (state == SLOT_QUEUED || state == SLOT_READING || state == SLOT_READ) waitMs = READ_POLL_MS;
+	}
+	if (series->playing) {
+		double next = (series->position + 1 - series->clockPosition) / series->rate -
+			std::chrono::duration<double>(std::chrono::steady_clock::now() - series->clockStart).count();
+		int nextMs = std::max((int)ceil(next * 1000), 1);
+		if (waitMs < 0 || nextMs < waitMs) waitMs = nextMs;
+	}
+	return waitMs;
+}
+
+int shownTimeStep(const TimeSeries *series)
+{
+	return series->slots[series->shownSlot].step;
+}
+
+const TimeSlot *shownTimeSlot(const TimeSeries *series)
+{
+	return &series->slots[series->shownSlot];
+}
+
+const float *shownTimeStepHistogram(const TimeSeries *series)
+{
+	return series->histograms[shownTimeStep(series)].data();
+}
+
+size_t timeSeriesBytes(const TimeSeries *series)
+{
+	const VolumeDesc *desc = &series->steps[0];
+	size_t textureBytes = (size_t)desc->dims[0] * desc->dims[1] * desc->dims[2] * (desc->type == VOXEL_UINT8 ? 1 : 2);
+	size_t bytes = 0;
+	for (int s = 0; s < series->slotCount; s++) bytes += textureBytes + series->slots[s].bufferBytes;
+	return bytes;
+}
+
+void printTimeSeriesStats(TimeSeries *series)
+{
+	TimeSeriesStats *stats = &series->stats;
+	std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+	double seconds = std::chrono::duration<double>(now - stats->start).count();
+
+	if (stats->passed > 0) {
+		printf("Time series: %d steps in %.2f s, %.1f steps/s (target %g): %d drawn, %d dropped by the renderer, "
+			"%d by the loader; %.0f ms late, %d frames\n", stats->passed, seconds, stats->passed / seconds, series->rate,
+			stats->drawn, stats->droppedRendering, stats->droppedLoading, stats->lateMs, stats->frames);
+	}
+	else {
+		printf("Time series: %d frames in %.2f s, %.0f ms waiting for steps\n", stats->frames, seconds, stats->lateMs);
+	}
+	if (stats->loads > 0) {
+		printf("  loaded %d steps: %.1f ms reading, %.1f ms bricks, %.1f ms upload per step, %.1f MB/s read\n", stats->loads,
+			1000 * stats->readSeconds / stats->loads, 1000 * stats->brickSeconds / stats->loads,
+			1000 * stats->uploadSeconds / stats->loads,
+			stats->readSeconds > 0 ? stats->loads * series->stepBytes / 1048576.0 / stats->readSeconds : 0);
+	}
+
+	*stats = TimeSeriesStats();
+	stats->start = now;
+}
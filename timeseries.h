@@ -0,0 +1,164 @@
+// timeseries.h: playback of time-varying volumes from a ring of textures
+//
+// A time series is a sequence of volume files of one layout, one per time
+// step, named by a pattern with a step number (beat_%02d_128_128_96.raw).
+// Only a ring of K steps lives on the GPU, each in a 3D texture of its own:
+// the step on screen and the ones after it. A background I/O thread reads
+// the upcoming steps into pixel-unpack buffers the render thread mapped for
+// it, fixing byte order on the way, and the render thread hands the filled
+// buffers to glTexSubImage3D once they are done. Slots whose steps fell
+// behind the playback position are reused for the next steps ahead.
+//
+// The I/O thread also counts the histogram and builds the min/max brick
+// grid of every step while its voxels pass through, so switching steps
+// swaps in the step's histogram for the transfer function editor and its
+// value ranges for empty-space skipping without touching the voxels again.
+// The histograms of all steps read so far are kept.
+//
+// Playback follows the wall clock at a target rate of steps per second.
+// A step whose time has come but that is not resident yet is skipped
+// rather than waited for, and while reading a step takes longer than a
+// step lasts, the ring starts as many steps ahead as the clock passes
+// during a read instead of at the step on screen. Every step the clock
+// passes is either drawn, dropped by the renderer (resident, but no frame
+// was drawn during its time) or dropped by the loader (not resident in
+// time). The counts are printed once per loop through the series.
+//
+//////////////////////////////////////////////////////////////////////
+
+#ifndef TIMESERIES_H
+#define TIMESERIES_H
+
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <chrono>
+
+#include <GL/glew.h>
+
+#include "volumefile.h"
+#include "brickgrid.h"
+
+#define MAX_TIME_SLOTS 16
+
+enum TimeSlotState
+{
+	SLOT_FREE,
+	SLOT_QUEUED,		// waiting for the I/O thread
+	SLOT_READING,		// the I/O thread is filling the buffer
+	SLOT_READ,			// filled, waiting for the upload
+	SLOT_RESIDENT		// the texture holds the step
+};
+
+struct TimeSlot
+{
+	GLuint texture;
+	GLuint buffer;						// pixel-unpack buffer the I/O thread fills
+	int step;							// -1 if free
+	std::atomic<TimeSlotState> state;	// the I/O thread moves QUEUED slots on to READ
+	unsigned char *target;				// mapped buffer, NULL if mapping failed
+	std::vector<unsigned char> staging;	// filled instead if mapping failed
+	bool failed;						// the step could not be read
+	BrickGrid bricks;					// value ranges of the step
+	double readSeconds, brickSeconds;	// I/O thread time spent on the step
+	size_t bufferBytes;					// allocated for the buffer so far
+};
+
+struct TimeSeriesStats
+{
+	std::chrono::steady_clock::time_point start;
+	int passed;							// steps the playback clock moved past
+	int drawn, droppedRendering, droppedLoading;
+	int frames;							// frames drawn
+	double lateMs;						// time a newer step was due than the one shown
+	int loads;
+	double readSeconds, brickSeconds, uploadSeconds;
+};
+
+struct TimeSeries
+{
+	std::vector<VolumeDesc> steps;
+	std::vector<std::vector<float> > histograms;	// per step, empty until read
+	size_t stepBytes;					// texels of a step, as uploaded
+
+	TimeSlot slots[MAX_TIME_SLOTS];
+	int slotCount;
+
+	// requests to the I/O thread: slots to fill
+	std::thread io;
+	std::mutex lock;
+	std::condition_variable signal;
+	std::deque<int> requests;
+	bool quit;
+
+	// playback clock: position is the step number counted across loops
+	float rate;							// steps per second
+	bool playing;
+	std::chrono::steady_clock::time_point clockStart;
+	long long clockPosition;			// position at clockStart
+	long long position;					// position the clock is at
+	std::chrono::steady_clock::time_point lastUpdate;
+	int shownSlot;						// slot whose texture is on screen
+	bool positionShown, positionDrawn;	// the step of the position was shown, and drawn in a frame
+	double readAverage;					// seconds the I/O thread takes per step, moving average
+
+	TimeSeriesStats stats;
+};
+
+// The steps of pattern (a printf pattern with one step number), counted from
+// 0 or 1 up to the first missing file. Every step has the layout of first;
+// a header of a step only says where its voxels are. Returns false (and
+// prints the reason) if there is no step or the dimensions do not match.
+bool findTimeSteps(const char *pattern, const VolumeDesc *first, std::vector<VolumeDesc> *steps);
+
+// The name of the first step of pattern, or false if there is none.
+bool firstTimeStepFile(const char *pattern, char *filename, size_t size);
+
+// Creates ringSize slots (2 to MAX_TIME_SLOTS, at most the number of
+// steps) and starts the I/O thread. texture already holds step 0 with the
+// given histogram and bricks; it becomes the first slot and is shown. The
+// other slots get textures like it and the prefetch of the next steps starts.
+void createTimeSeries(const std::vector<VolumeDesc> &steps, int ringSize, float rate, GLuint texture,
+	const float histogram[256], const BrickGrid *bricks, TimeSeries *series);
+void destroyTimeSeries(TimeSeries *series);
+
+// Stops the I/O thread only, for exit handlers running without a GL context.
+void stopTimeSeriesLoader(TimeSeries *series);
+
+// Uploads the steps the I/O thread has read, moves the clock, switches to
+// the step it points at if that is resident and queues the reads of the
+// steps ahead. Returns true if a different step is shown now.
+bool updateTimeSeries(TimeSeries *series);
+
+// Blocks until the step of the clock position is shown (or failed to load).
+// Returns true if a different step is shown now.
+bool waitForTimeStep(TimeSeries *series);
+
+void playTimeSeries(TimeSeries *series, bool playing);
+
+// Pauses at position; the step shown is position modulo the number of
+// steps, so position - 1 from step 0 is the last step.
+void seekTimeSeries(TimeSeries *series, long long position);
+
+// Counts a frame drawn with the step shown.
+void timeStepDrawn(TimeSeries *series);
+
+// Milliseconds until updateTimeSeries has something to do: a read that is
+// in flight or the next step of the clock. -1 if nothing will change.
+int timeSeriesWaitMs(const TimeSeries *series);
+
+// The step on screen, its texture, histogram and bricks.
+int shownTimeStep(const TimeSeries *series);
+const TimeSlot *shownTimeSlot(const TimeSeries *series);
+const float *shownTimeStepHistogram(const TimeSeries *series);
+
+// GPU memory of the slot textures and their buffers.
+size_t timeSeriesBytes(const TimeSeries *series);
+
+// Prints the statistics since the last call and starts new ones.
+void printTimeSeriesStats(TimeSeries *series);
+
+#endif
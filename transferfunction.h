@@ -14,9 +14,24 @@ float nodeInSize = 0.025;
 float nodeOutSize = 0.03;
 float LineWidth = 0.01;
 
+// entries of transferFunction[] to recompute on the next repaint (none if
+// first > last); everything at the start
+int tableDirtyFirst = 0;
+int tableDirtyLast = 255;
+
+// marks the entries covered by the segments on both sides of a node
+void markNodeDirty(int node)
+{
+	int left = node > 0 ? node - 1 : 0;
+	int right = node < nodeNum - 1 ? node + 1 : nodeNum - 1;
+	int first = int(points[left][0] * 255);
+	int last = int(points[right][0] * 255);
+	if (first < tableDirtyFirst) tableDirtyFirst = first;
+	if (last > tableDirtyLast) tableDirtyLast = last;
+}
+
 void renderScene_transferFunction(void) 
 {
-	transferFunctionChanged = true;
 	glClearColor(1, 1, 1, 1);
 	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 	glUseProgram(0);
@@ -59,15 +74,18 @@ void renderScene_transferFunction(void)
 	glEnd();
 
 
+	// recompute only the entries the mouse handlers have touched
 	float a = points[0][1];
 	float r = colors[0][0];
 	float g = colors[0][1];
 	float b = colors[0][2];
-	transferFunction[0] = r;
-	transferFunction[1] = g;
-	transferFunction[2] = b;
-	transferFunction[3] = a;
-	for (int i = 0; i<nodeNum - 1; i++) {
+	if (tableDirtyFirst == 0) {
+		transferFunction[0] = r;
+		transferFunction[1] = g;
+		transferFunction[2] = b;
+		transferFunction[3] = a;
+	}
+	for (int i = 0; i<nodeNum - 1 && tableDirtyFirst <= tableDirtyLast; i++) {
 		float a1 = points[i][1];
 		float a2 = points[i + 1][1];
 		float r1 = colors[i][0];
@@ -78,8 +96,10 @@ void renderScene_transferFunction(void)
 		float b2 = colors[i + 1][2];
 		int x1 = int(points[i][0] * 255);
 		int x2 = int(points[i + 1][0] * 255);
+		if (x2 < tableDirtyFirst || x1 + 1 > tableDirtyLast) continue;
 
 		for (int j = x1 + 1; j <= x2; j++) {
+			if (j < tableDirtyFirst || j > tableDirtyLast) continue;
 
 			float rr1 = (r2 - r1) / (x2 - x1)*(j - x1) + r1;
 			float gg1 = (g2 - g1) / (x2 - x1)*(j - x1) + g1;
@@ -96,6 +116,11 @@ void renderScene_transferFunction(void)
 			transferFunction[j * 4 + 3] = a;
 		}
 	}
+	if (tableDirtyFirst <= tableDirtyLast) {
+		transferFunctionEdited(tableDirtyFirst, tableDirtyLast);
+		tableDirtyFirst = 256;
+		tableDirtyLast = -1;
+	}
 
 
 	glBegin(GL_QUADS);
@@ -151,6 +176,7 @@ void  mouseClick_transferFunction(int button, int state, int x, int y) {
 		if (mod == GLUT_ACTIVE_SHIFT) {
 			for (int i = 1; i < nodeNum-1; i++) {
 				if (abs(mousePos[0] - points[i][0]) < nodeOutSize && abs(mousePos[1] - points[i][1]) < nodeOutSize) {
+					markNodeDirty(i);
 					for (int j = i; j < nodeNum - 1; j++) {
 						points[j][0] = points[j + 1][0];
 						points[j][1] = points[j + 1][1];
@@ -168,6 +194,7 @@ void  mouseClick_transferFunction(int button, int state, int x, int y) {
 					colors[i][0] = float(rand()) / RAND_MAX;
 					colors[i][1] = float(rand()) / RAND_MAX;
 					colors[i][2] = float(rand()) / RAND_MAX;
+					markNodeDirty(i);
 					break;
 				}
 			}
@@ -195,6 +222,7 @@ void  mouseClick_transferFunction(int button, int state, int x, int y) {
 					colors[i][1] = float(rand()) / RAND_MAX;
 					colors[i][2] = float(rand()) / RAND_MAX;
 					nodeNum++;
+					markNodeDirty(i);
 					break;
 				}
 			}
@@ -218,6 +246,8 @@ void  mouseClick_transferFunction(int button, int state, int x, int y) {
 void mouseMove_transferFunction(int x, int y) {
 	if (mouseButton_transferFunction == GLUT_LEFT_BUTTON) {
 		if (selectPoint != -1) {
+			// the segments next to the node before and after the move
+			markNodeDirty(selectPoint);
 			float newX = (float(x) / tfWidth * 2 - 1) / 1.6 + 0.5;
 			float newY= ((1 - float(y) / tfHeight) * 2 - 1) / 1.6 + 0.5;
 			if (newX > 1)newX = 1;
@@ -259,6 +289,7 @@ void mouseMove_transferFunction(int x, int y) {
 				}
 			}
 			points[selectPoint][1] = newY;
+			markNodeDirty(selectPoint);
 		}
 	}
 	glutPostRedisplay();
@@ -279,7 +310,6 @@ void init_transferFunction()
 	glutReshapeFunc(changeSize_transferFunction);
 	glutMouseFunc(mouseClick_transferFunction);
 	glutMotionFunc(mouseMove_transferFunction);
-	glutIdleFunc(idle);
 
 	// init default parameters	
 	nodeNum = 2;
@@ -2,90 +2,382 @@
 
 in vec3 pixelPosition;
 
+// the visibility feedback pass of paged volumes writes page requests instead of colours
+#ifdef VISIBILITY_FEEDBACK
+vec4 fragColor;
+layout(location = 0) out uvec4 pageFeedback;
+#else
+out vec4 fragColor;
+#endif
+
 uniform vec3 eye;
-uniform int render_mode;
 uniform float iso_value;
 
+// distance between two samples along the ray (the volume box is 2 wide)
+uniform float step_size;
+
+// transfer function opacities are defined for samples this far apart and
+// corrected to the actual step size
+const float REFERENCE_STEP = 0.001;
+
+// RENDER_MODE is defined when the program is specialized for one mode; the
+// branches of the other modes are then removed by the compiler
+#ifdef RENDER_MODE
+const int render_mode = RENDER_MODE;
+#else
+uniform int render_mode;
+#endif
+
 uniform sampler3D tex;
+uniform vec3 volume_dims;	// voxels of the volume, whether tex holds all of them or the page pool
+
+// level of detail: the pyramid level (mip level of tex) whose voxels match
+// the footprint of a pixel where the ray enters the volume; the ray then
+// steps that much further in MIP, compositing and iso-surface mode
+uniform float lod_scale;	// footprint of a pixel, in voxels of level 0, per unit of distance from the eye
+uniform float max_lod;		// coarsest level, 0: no pyramid or level of detail off
+uniform float lod_bias;
+float lod = 0.0;
+
+// paged volumes: tex is a pool of PAGE_STORAGE^3 slots, each holding a page
+// of the volume and a one voxel apron, and pageTable the slot of every page
+// (alpha 0: not resident, sampled as 0)
+uniform bool paged_volume;
+uniform usampler3D pageTable;
+const float PAGE_SIZE = 64.0;	// must match PAGE_SIZE in pagedvolume.h
+const float PAGE_STORAGE = PAGE_SIZE + 2.0;
 uniform sampler1D transferFunction;
 
+// pre-integrated compositing: colour and opacity of a ray segment by its front and back value
+uniform sampler2D preintegrationTable;	// computed for segments of length step_size
+
+// empty-space skipping: 0 in occupancy marks a brick the transfer function makes fully transparent
+uniform sampler3D occupancy;
+uniform bool empty_space_skipping;
+const int BRICK_SIZE = 8;	// must match BRICK_SIZE in brickgrid.h
+
+// iso-surface skipping: smallest and largest transfer function index (R, G)
+// of every brick, whatever the iso-value; bricks whose largest value stays
+// below iso_value are crossed without sampling
+uniform sampler3D valueRange;
+
+// secant steps refining the surface between the last sample below and the
+// first sample above iso_value
+uniform int iso_refinement;
+
+// shading gradients: central differences of the volume on the fly, or one
+// fetch from the precomputed gradient volume (direction in RGB, magnitude
+// relative to gradient_scale in A)
+uniform sampler3D gradients;
+uniform bool precomputed_gradients;
+uniform float gradient_scale;		// 1 / largest gradient magnitude of the volume
+
+// Phong shading of the compositing samples
+uniform bool shaded_compositing;
+
+// ray start jitter: every ray starts a fraction of a step behind its entry,
+// read from a tiling blue-noise rank map and rotated by the golden ratio for
+// each frame averaged into the progressive accumulation
+uniform sampler2D blueNoise;
+uniform bool ray_jitter;
+uniform float jitter_frame;
+
+float rayStartOffset() {
+	if (!ray_jitter) return 0.0;
+	float rank = texelFetch(blueNoise, ivec2(gl_FragCoord.xy) % textureSize(blueNoise, 0), 0).r;
+	return fract(rank + jitter_frame * 0.61803398875);
+}
+
+// debugging aid: output the number of volume samples of the ray instead of its color
+uniform bool output_sample_count;
+
+vec4 encodeCount(int n) {
+	return vec4(float(n & 255), float((n >> 8) & 255), float((n >> 16) & 255), 255.0) / 255.0;
+}
+
+// debugging aid: number of loop iterations (volume samples) of the ray
+int samples = 0;
+
+#ifdef VISIBILITY_FEEDBACK
+// the first page the ray found missing (alpha 2), else one of the pages it
+// used (alpha 1), chosen uniformly and differently in every feedback frame
+uniform int feedback_frame;
+uvec4 feedbackPage = uvec4(0u);
+ivec3 lastPage = ivec3(-1);
+int pagesUsed = 0;
+
+float feedbackRandom(int n) {
+	return fract(sin(dot(vec3(gl_FragCoord.xy, float(n * 131 + feedback_frame)), vec3(12.9898, 78.233, 37.719))) * 43758.5453);
+}
+
+void notePage(ivec3 page, bool resident) {
+	if (page == lastPage || feedbackPage.a == 2u) return;
+	lastPage = page;
+	if (!resident) {
+		feedbackPage = uvec4(uvec3(page), 2u);
+	}
+	else {
+		pagesUsed++;
+		if (feedbackRandom(pagesUsed) * float(pagesUsed) < 1.0) feedbackPage = uvec4(uvec3(page), 1u);
+	}
+}
+#endif
+
+// filtered value at a volume texture coordinate
+float volumeAt(vec3 texCoord) {
+	if (!paged_volume) return textureLod(tex, texCoord, lod).r;
+
+	// voxel centres at integers, like the filtering of a whole volume texture
+	vec3 voxel = clamp(texCoord * volume_dims - 0.5, vec3(-0.5), volume_dims - 0.5);
+	ivec3 page = clamp(ivec3(floor(voxel / PAGE_SIZE)), ivec3(0), textureSize(pageTable, 0) - 1);
+	uvec4 entry = texelFetch(pageTable, page, 0);
+#ifdef VISIBILITY_FEEDBACK
+	notePage(page, entry.a != 0u);
+#endif
+	if (entry.a == 0u) return 0.0;
+
+	vec3 pooled = vec3(entry.rgb) * PAGE_STORAGE + 1.0 + (voxel - vec3(page) * PAGE_SIZE) + 0.5;
+	return texture(tex, pooled / vec3(textureSize(tex, 0))).r;
+}
+
+float sampleVolume(vec3 position) {
+	samples++;
+	return volumeAt((position + vec3(1.0)) / 2);
+}
+
+// gradient direction (not normalized) at a volume texture coordinate, and its
+// magnitude relative to the largest in the volume
+vec3 gradientAt(vec3 texCoord, out float magnitude) {
+	if (precomputed_gradients) {
+		vec4 texel = texture(gradients, texCoord);
+		magnitude = texel.a;
+		return texel.rgb * 2.0 - 1.0;
+	}
+
+	// one voxel of the level sampled apart, scaled back to level 0 units
+	vec3 size = volume_dims;
+	float spacing = exp2(floor(lod));
+	vec3 diff = spacing / size;
+	float dx = (volumeAt(texCoord + vec3(diff.r, 0.0, 0.0)) - volumeAt(texCoord - vec3(diff.r, 0.0, 0.0))) / (size.r * spacing);
+	float dy = (volumeAt(texCoord + vec3(0.0, diff.g, 0.0)) - volumeAt(texCoord - vec3(0.0, diff.g, 0.0))) / (size.g * spacing);
+	float dz = (volumeAt(texCoord + vec3(0.0, 0.0, diff.b)) - volumeAt(texCoord - vec3(0.0, 0.0, diff.b))) / (size.b * spacing);
+	vec3 gradient = vec3(dx, dy, dz);
+	magnitude = min(length(gradient) * gradient_scale, 1.0);
+	return gradient;
+}
+
+// lit colour of a compositing sample: two-sided diffuse and specular
+// lighting, faded out where the gradient is too weak to define a surface
+vec3 shadeSample(vec3 color, vec3 position, vec3 rayDirection) {
+	float magnitude;
+	vec3 gradient = gradientAt((position + vec3(1.0)) / 2, magnitude);
+	if (magnitude <= 0.0) return color;
+	vec3 normal = -normalize(gradient);
+
+	vec3 light = normalize(vec3(-1.0, -1.0, -1.0));
+	float diffuse = abs(dot(light, normal));
+	vec3 reflected = 2.0 * dot(light, normal) * normal - light;
+	float specular = pow(max(dot(reflected, -rayDirection), 0.0), 10);
+	vec3 lit = color * (0.3 + 0.7 * diffuse) + vec3(0.3 * specular);
+	return mix(color, lit, min(magnitude * 8.0, 1.0));
+}
+
+// brick of the grid containing position
+ivec3 brickAt(vec3 position) {
+	vec3 brickExtent = 2.0 * float(BRICK_SIZE) / volume_dims;
+	return clamp(ivec3((position + vec3(1.0)) / brickExtent), ivec3(0), textureSize(occupancy, 0) - 1);
+}
+
+// distance from position to where the ray leaves brick
+float brickExit(ivec3 brick, vec3 position, vec3 safeDirection) {
+	vec3 brickExtent = 2.0 * float(BRICK_SIZE) / volume_dims;
+	vec3 brickMin = vec3(brick) * brickExtent - vec3(1.0);
+	vec3 exitPlane = brickMin + step(0.0, safeDirection) * brickExtent;
+	vec3 exitT = (exitPlane - position) / safeDirection;
+	return max(min(exitT.x, min(exitT.y, exitT.z)), 0.0);
+}
+
+// distance from position to where the ray leaves its brick if the brick is empty, -1 otherwise
+float emptyBrickExit(vec3 position, vec3 safeDirection) {
+	ivec3 brick = brickAt(position);
+	if (texelFetch(occupancy, brick, 0).r != 0.0) return -1.0;
+	return brickExit(brick, position, safeDirection);
+}
+
+// the same for bricks that cannot reach iso_value. Index i covers the values
+// [i/256, (i+1)/256), so every sample of the brick is below (max+1)/256; the
+// top index also holds values clamped from above and is never skipped.
+float belowIsoBrickExit(vec3 position, vec3 safeDirection) {
+	ivec3 brick = brickAt(position);
+	float largest = floor(texelFetch(valueRange, brick, 0).g * 255.0 + 0.5);
+	if (largest >= 255.0 || (largest + 1.0) / 256.0 > iso_value) return -1.0;
+	return brickExit(brick, position, safeDirection);
+}
+
 void main(){
 	vec3 rayDirection = normalize(pixelPosition - eye);
-	float dt = 0.001f;
-	vec3 position = pixelPosition;
+	float dt = step_size;
+
+	// entry and exit of the ray through the [-1,1]^3 volume box, computed once
+	vec3 safeDirection = mix(rayDirection, vec3(1e-6), lessThan(abs(rayDirection), vec3(1e-6)));
+	vec3 t0 = (vec3(-1.0) - eye) / safeDirection;
+	vec3 t1 = (vec3(1.0) - eye) / safeDirection;
+	vec3 tMin = min(t0, t1);
+	vec3 tMax = max(t0, t1);
+	float tNear = max(max(tMin.x, tMin.y), max(tMin.z, 0.0));
+	float tFar = min(min(tMax.x, tMax.y), tMax.z);
+	if (tFar <= tNear) discard;	// the ray misses the box or only grazes it
+	if (max_lod > 0.0) {
+		lod = clamp(log2(max(tNear * lod_scale, 1.0)) + lod_bias, 0.0, max_lod);
+		if (render_mode != 3) dt *= exp2(lod);	// the pre-integration table is made for step_size
+	}
+	// the brick ranges hold the voxels of level 0 and one voxel around the
+	// brick, the reach of its trilinear samples; the filter of a coarser
+	// level reaches further, so rays sampling one do not skip bricks
+	bool skipBricks = empty_space_skipping && lod == 0.0;
+	tNear += rayStartOffset() * dt;
+	vec3 entry = eye + tNear * rayDirection;
 
 	// maximum intensity projection
 	if (render_mode == 0) {
 		float maxValue = 0.0;
-		while (all(lessThanEqual(vec3(-1.0), position)) && all(lessThanEqual(position, vec3(1.0)))) {
-			vec3 texCoord = (position + vec3(1.0)) / 2;
-			float voxelValue = texture(tex, texCoord).r;
+		int count = int((tFar - tNear) / dt) + 1;
+		for (int i = 0; i < count; i++) {
+			float voxelValue = sampleVolume(entry + float(i) * dt * rayDirection);
 			if (maxValue < voxelValue) maxValue = voxelValue;
-	
-			position += dt * rayDirection;
 		}
-		gl_FragColor = vec4(vec3(maxValue), 1.0);
+		fragColor = vec4(vec3(maxValue), 1.0);
 	}
 	// alpha compositing
 	else if (render_mode == 1) {
 		vec4 color = vec4(0.0);
-		while (all(lessThanEqual(vec3(-1.0), position)) && all(lessThanEqual(position, vec3(1.0)))) {
-			vec3 texCoord = (position + vec3(1.0)) / 2;
-			float voxelValue = texture(tex, texCoord).r;
+		int count = int((tFar - tNear) / dt) + 1;
+		for (int i = 0; i < count; i++) {
+			vec3 position = entry + float(i) * dt * rayDirection;
+
+			if (skipBricks) {
+				float exit = emptyBrickExit(position, safeDirection);
+				if (exit >= 0.0) {
+					// continue with the first sample behind the brick
+					i = max(i, int(ceil((float(i) * dt + exit) / dt)) - 1);
+					continue;
+				}
+			}
+
+			float voxelValue = sampleVolume(position);
 			vec4 transferFunctionValue = texture(transferFunction, voxelValue);
-			transferFunctionValue.a = pow(transferFunctionValue.a, 5);
+			if (shaded_compositing && transferFunctionValue.a > 0.0) {
+				transferFunctionValue.rgb = shadeSample(transferFunctionValue.rgb, position, rayDirection);
+			}
+			transferFunctionValue.a = 1.0 - pow(1.0 - pow(transferFunctionValue.a, 5), dt / REFERENCE_STEP);
 			//color = color + (1.0 - color.a) * transferFunctionValue;
 			vec3 rgb = color.rgb + (1.0 - color.a) * transferFunctionValue.a * transferFunctionValue.rgb;
 			float alpha = color.a + (1.0 - color.a) * transferFunctionValue.a;
 			color = vec4(rgb, alpha);
 
 			if (color.a > 0.95) break;
-			position += dt * rayDirection;
 		}
-		gl_FragColor = color;
+		fragColor = color;
 	}
 	// iso-surface rendering
 	else if (render_mode == 2) {
-		dt = 0.01f;
-		int level = 0;
-		vec3 lastPosition = position;
-		while (all(lessThanEqual(vec3(-1.0), position)) && all(lessThanEqual(position, vec3(1.0)))) {
-			vec3 texCoord = (position + vec3(1.0)) / 2;
-			float voxelValue = texture(tex, texCoord).r;
-			if (iso_value < voxelValue) {
-				if (level < 3) {
-					level++;
-					position = lastPosition;
-					dt /= 2;
+		fragColor = vec4(0.0);
+		int count = int((tFar - tNear) / dt) + 1;
+		int previous = -1;			// last sample taken, and its value
+		float previousValue = 0.0;
+		for (int i = 0; i < count; i++) {
+			if (skipBricks) {
+				float exit = belowIsoBrickExit(entry + float(i) * dt * rayDirection, safeDirection);
+				if (exit >= 0.0) {
+					// continue with the first sample behind the brick
+					i = max(i, int(ceil((float(i) * dt + exit) / dt)) - 1);
 					continue;
 				}
-				else {
-					// compute normal
-					vec3 size = textureSize(tex, 0);
-					vec3 diff = 1 / size;
-					float dx = (texture(tex, texCoord + vec3(diff.r, 0.0, 0.0)).r - texture(tex, texCoord - vec3(diff.r, 0.0, 0.0)).r) / size.r;
-					float dy = (texture(tex, texCoord + vec3(0.0, diff.g, 0.0)).r - texture(tex, texCoord - vec3(0.0, diff.g, 0.0)).r) / size.g;
-					float dz = (texture(tex, texCoord + vec3(0.0, 0.0, diff.b)).r - texture(tex, texCoord - vec3(0.0, 0.0, diff.b)).r) / size.b;
-					vec3 normal = -normalize(vec3(dx, dy, dz));
-
-					// phong lighting
-					vec3 light = normalize(vec3(-1.0, -1.0, -1.0));
-					vec3 diffuse = max(dot(light, normal), 0.0) * vec3(1.0, 0.0, 0.0);
-				
-					vec3 reflect = 2.0 * dot(light, normal) * normal - light;
-					vec3 view = -rayDirection;
-					vec3 specular = pow(max(dot(reflect, view), 0.0), 10) * vec3(1.0);
-
-					vec3 ambient = vec3(0.1);
-
-					gl_FragColor = vec4(diffuse + specular + ambient, 1.0);
-					return;
+			}
+
+			float value = sampleVolume(entry + float(i) * dt * rayDirection);
+			if (value <= iso_value) {
+				previous = i;
+				previousValue = value;
+				continue;
+			}
+
+			// the surface lies between the previous sample and this one. The
+			// previous one is only missing behind a skipped brick.
+			float below = float(max(i - 1, 0)) * dt;
+			float above = float(i) * dt;
+			float belowValue = previous == i - 1 ? previousValue : sampleVolume(entry + below * rayDirection);
+			float aboveValue = value;
+
+			// secant steps, kept inside the bracket so that a flat end cannot stall them
+			float hit = above;
+			if (i > 0) {
+				for (int k = 0; k < iso_refinement; k++) {
+					float w = clamp((iso_value - belowValue) / max(aboveValue - belowValue, 1e-6), 0.05, 0.95);
+					float t = mix(below, above, w);
+					float v = sampleVolume(entry + t * rayDirection);
+					if (v > iso_value) {
+						above = t;
+						aboveValue = v;
+					}
+					else {
+						below = t;
+						belowValue = v;
+					}
+				}
+				hit = mix(below, above, clamp((iso_value - belowValue) / max(aboveValue - belowValue, 1e-6), 0.0, 1.0));
+			}
+			vec3 position = entry + hit * rayDirection;
+			vec3 texCoord = (position + vec3(1.0)) / 2;
+
+			// compute normal
+			float magnitude;
+			vec3 normal = -normalize(gradientAt(texCoord, magnitude));
+
+			// phong lighting
+			vec3 light = normalize(vec3(-1.0, -1.0, -1.0));
+			vec3 diffuse = max(dot(light, normal), 0.0) * vec3(1.0, 0.0, 0.0);
+		
+			vec3 reflect = 2.0 * dot(light, normal) * normal - light;
+			vec3 view = -rayDirection;
+			vec3 specular = pow(max(dot(reflect, view), 0.0), 10) * vec3(1.0);
+
+			vec3 ambient = vec3(0.1);
+
+			fragColor = vec4(diffuse + specular + ambient, 1.0);
+			break;
+		}
+	}
+	// pre-integrated alpha compositing
+	else if (render_mode == 3) {
+		vec4 color = vec4(0.0);
+		int count = int((tFar - tNear) / dt) + 1;
+		float front = sampleVolume(entry);
+		for (int i = 1; i < count; i++) {
+			float back = sampleVolume(entry + float(i) * dt * rayDirection);
+			vec4 segment = texture(preintegrationTable, vec2(front, back));
+			color.rgb = color.rgb + (1.0 - color.a) * segment.rgb;
+			color.a = color.a + (1.0 - color.a) * segment.a;
+			front = back;
+
+			if (color.a > 0.95) break;
+
+			if (skipBricks) {
+				// segments entirely inside an empty brick are transparent, the
+				// one leaving it starts at the last sample inside
+				float exit = emptyBrickExit(entry + float(i) * dt * rayDirection, safeDirection);
+				int last = min(int(ceil((float(i) * dt + exit) / dt)) - 1, count - 1);
+				if (exit >= 0.0 && last > i) {
+					i = last;
+					front = sampleVolume(entry + float(i) * dt * rayDirection);
 				}
 			}
-	
-			lastPosition = position;
-			position += dt * rayDirection;
 		}
-		gl_FragColor = vec4(0.0);
+		fragColor = color;
 	}
+
+	if (output_sample_count) fragColor = encodeCount(samples);
+#ifdef VISIBILITY_FEEDBACK
+	pageFeedback = feedbackPage;
+#endif
 }
\ No newline at end of file
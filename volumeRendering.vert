@@ -1,10 +1,13 @@
-#version 140
-#extension GL_ARB_compatibility: enable
+#version 330 core
+
+layout(location = 0) in vec3 position;
+
+uniform mat4 modelViewProjection;
 
 out vec3 pixelPosition;
 
 void main()
 {
-    pixelPosition = vec3(gl_Vertex);
-    gl_Position   = gl_ModelViewProjectionMatrix * gl_Vertex;
+    pixelPosition = position;
+    gl_Position   = modelViewProjection * vec4(position, 1.0);
 }
\ No newline at end of file
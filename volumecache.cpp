@@ -0,0 +1,519 @@
+// volumecache.cpp
+//
+// Content hashing and the sidecar cache file of preprocessing results
+//
+//////////////////////////////////////////////////////////////////////
+
+#include <stdio.h>
+#include <string.h>
+
+#include <algorithm>
+#include <thread>
+
+#include "volumecache.h"
+#include "brickgrid.h"
+
+#define CACHE_VERSION 2
+#define CACHE_BYTE_ORDER 0x01020304u
+#define HASH_CHUNK (4 << 20)			// bytes hashed independently, then combined in order
+
+enum CacheSectionTag
+{
+	SECTION_HISTOGRAM = 1,
+	SECTION_BRICKS,
+	SECTION_GRADIENTS,
+	SECTION_PYRAMID
+};
+
+static const char *sectionName(unsigned int tag)
+{
+	switch (tag) {
+		case SECTION_HISTOGRAM: return "histogram";
+		case SECTION_BRICKS: return "bricks";
+		case SECTION_GRADIENTS: return "gradients";
+		case SECTION_PYRAMID: return "pyramid";
+	}
+	return "unknown";
+}
+
+struct CacheHeader
+{
+	char magic[8];						// "VOLCACHE"
+	unsigned int version;
+	unsigned int byteOrder;				// CACHE_BYTE_ORDER as the writing host stores it
+	unsigned long long hash;
+	int dims[3];
+	int type;
+	int bigEndian;
+	unsigned int sectionCount;
+	double loadSeconds;
+};
+
+struct CacheSection
+{
+	unsigned int tag;
+	unsigned int param;					// filter (and format) the part was built with
+	unsigned long long offset;			// from the start of the file
+	unsigned long long size;
+	double seconds;
+};
+
+// payload prefixes, padded to 16 bytes so the data after them stays aligned
+struct BrickPrefix
+{
+	int dims[3];
+	int unused;
+};
+
+struct GradientPrefix
+{
+	float largest;
+	int unused[3];
+};
+
+struct PyramidPrefix
+{
+	unsigned int count;
+	int unused[3];
+};
+
+struct PyramidLevelEntry
+{
+	int dims[3];
+	int unused;
+	unsigned long long offset;			// from the start of the payload
+};
+
+
+//
+// Content hash: four 64-bit multiply-rotate lanes per chunk
+//
+static const unsigned long long PRIME1 = 0x9E3779B185EBCA87ULL;
+static const unsigned long long PRIME2 = 0xC2B2AE3D27D4EB4FULL;
+static const unsigned long long PRIME3 = 0x165667B19E3779F9ULL;
+
+static inline unsigned long long rotl(unsigned long long x, int r)
+{
+	return (x << r) | (x >> (64 - r));
+}
+
+static inline unsigned long long hashRound(unsigned long long acc, unsigned long long input)
+{
+	return rotl(acc + input * PRIME2, 31) * PRIME1;
+}
+
+static inline unsigned long long finalMix(unsigned long long h)
+{
+	h ^= h >> 33;
+	h *= PRIME2;
+	h ^= h >> 29;
+	h *= PRIME3;
+	h ^= h >> 32;
+	return h;
+}
+
+static unsigned long long hashChunk(const unsigned char *p, size_t size)
+{
+	unsigned long long lanes[4] = { PRIME1 + PRIME2, PRIME2, 0, 0 - PRIME1 };
+	size_t i = 0;
+	for (; i + 32 <= size; i += 32) {
+		unsigned long long words[4];
+		memcpy(words, p + i, 32);
+		lanes[0] = hashRound(lanes[0], words[0]);
+		lanes[1] = hashRound(lanes[1], words[1]);
+		lanes[2] = hashRound(lanes[2], words[2]);
+		lanes[3] = hashRound(lanes[3], words[3]);
+	}
+
+	unsigned long long h = rotl(lanes[0], 1) + rotl(lanes[1], 7) + rotl(lanes[2], 12) + rotl(lanes[3], 18);
+	for (; i < size; i++) {
+		h = (h ^ p[i]) * PRIME1;
+	}
+	return finalMix(h ^ size);
+}
+
+static void hashChunks(const unsigned char *data, size_t size, unsigned long long *hashes, size_t c0, size_t c1)
+{
+	for (size_t c = c0; c < c1; c++) {
+		size_t offset = c * HASH_CHUNK;
+		hashes[c] = hashChunk(data + offset, std::min((size_t)HASH_CHUNK, size - offset));
+	}
+}
+
+unsigned long long hashVolume(const unsigned char *data, size_t size)
+{
+	size_t chunks = (size + HASH_CHUNK - 1) / HASH_CHUNK;
+	std::vector<unsigned long long> hashes(chunks);
+
+	size_t threads = std::thread::hardware_concurrency();
+	if (threads > chunks) threads = chunks;
+	if (threads < 1) threads = 1;
+
+	std::vector<std::thread> workers;
+	for (size_t t = 0; t < threads; t++) {
+		workers.push_back(std::thread(hashChunks, data, size, hashes.data(), chunks * t / threads, chunks * (t + 1) / threads));
+	}
+	for (size_t t = 0; t < threads; t++) {
+		workers[t].join();
+	}
+
+	unsigned long long h = PRIME3 ^ size;
+	for (size_t c = 0; c < chunks; c++) {
+		h = hashRound(h, hashes[c]);
+	}
+	return finalMix(h);
+}
+
+
+void clearVolumeCacheContents(VolumeCacheContents *contents)
+{
+	contents->histogram = NULL;
+	contents->histogramSeconds = 0;
+	memset(contents->brickDims, 0, sizeof(contents->brickDims));
+	contents->brickMinMax = NULL;
+	contents->brickSeconds = 0;
+	contents->gradientFilter = GRADIENT_CENTRAL;
+	contents->gradientFormat = GRADIENT_RGBA8;
+	contents->gradientLargest = 0;
+	contents->gradients = NULL;
+	contents->gradientSeconds = 0;
+	contents->pyramidFilter = PYRAMID_GAUSSIAN;
+	contents->pyramid.clear();
+	contents->pyramidSeconds = 0;
+	contents->loadSeconds = 0;
+}
+
+void volumeCachePath(const char *directory, const VolumeDesc *desc, unsigned long long hash, char *path, size_t pathSize)
+{
+	if (directory == NULL) {
+		snprintf(path, pathSize, "%s.cache", desc->dataFile);
+	}
+	else {
+		snprintf(path, pathSize, "%s/%016llx_%dx%dx%d_%s.cache", directory, hash,
+			desc->dims[0], desc->dims[1], desc->dims[2], voxelTypeName(desc->type));
+	}
+}
+
+static size_t voxelCount(const int dims[3])
+{
+	return (size_t)dims[0] * dims[1] * dims[2];
+}
+
+// bytes per voxel of the pyramid levels, which store int16 biased like uint16
+static int levelVoxelSize(VoxelType type)
+{
+	return voxelSize(type == VOXEL_INT16 ? VOXEL_UINT16 : type);
+}
+
+
+//
+// Reading: every section is checked against the volume before its parts
+// are exposed, so a damaged section costs only its rebuild
+//
+static bool readPyramid(const unsigned char *payload, size_t size, const VolumeDesc *desc, std::vector<CachedLevel> *levels)
+{
+	if (size < sizeof(PyramidPrefix)) return false;
+	PyramidPrefix prefix;
+	memcpy(&prefix, payload, sizeof(prefix));
+	if (prefix.count < 1 || (int)prefix.count >= pyramidLevelCount(desc->dims)) return false;
+	if (size < sizeof(PyramidPrefix) + prefix.count * sizeof(PyramidLevelEntry)) return false;
+
+	int dims[3] = { desc->dims[0], desc->dims[1], desc->dims[2] };
+	for (unsigned int l = 0; l < prefix.count; l++) {
+		PyramidLevelEntry entry;
+		memcpy(&entry, payload + sizeof(PyramidPrefix) + l * sizeof(PyramidLevelEntry), sizeof(entry));
+		for (int i = 0; i < 3; i++) {
+			dims[i] = std::max(dims[i] / 2, 1);
+			if (entry.dims[i] != dims[i]) return false;
+		}
+		size_t bytes = voxelCount(dims) * levelVoxelSize(desc->type);
+		if (entry.offset % CACHE_ALIGNMENT != 0 || entry.offset > size || bytes > size - entry.offset) return false;
+
+		CachedLevel level;
+		memcpy(level.dims, dims, sizeof(dims));
+		level.voxels = payload + entry.offset;
+		levels->push_back(level);
+	}
+	return true;
+}
+
+static bool readSection(const CacheSection *section, const unsigned char *payload, const VolumeDesc *desc, VolumeCacheContents *contents)
+{
+	size_t voxels = voxelCount(desc->dims);
+	switch (section->tag) {
+		case SECTION_HISTOGRAM:
+			if (section->size != 256 * sizeof(uint64_t)) return false;
+			contents->histogram = (const uint64_t *)payload;
+			contents->histogramSeconds = section->seconds;
+			return true;
+
+		case SECTION_BRICKS: {
+			if (section->size < sizeof(BrickPrefix)) return false;
+			BrickPrefix prefix;
+			memcpy(&prefix, payload, sizeof(prefix));
+			for (int i = 0; i < 3; i++) {
+				if (prefix.dims[i] != (desc->dims[i] + BRICK_SIZE - 1) / BRICK_SIZE) return false;
+			}
+			if (section->size != sizeof(BrickPrefix) + voxelCount(prefix.dims) * 2) return false;
+			memcpy(contents->brickDims, prefix.dims, sizeof(prefix.dims));
+			contents->brickMinMax = payload + sizeof(BrickPrefix);
+			contents->brickSeconds = section->seconds;
+			return true;
+		}
+
+		case SECTION_GRADIENTS: {
+			if (section->size != sizeof(GradientPrefix) + voxels * 4) return false;
+			if ((section->param & 0xff) > GRADIENT_SOBEL || (section->param >> 8) > GRADIENT_RGB10_A2) return false;
+			GradientPrefix prefix;
+			memcpy(&prefix, payload, sizeof(prefix));
+			contents->gradientFilter = (GradientFilter)(section->param & 0xff);
+			contents->gradientFormat = (GradientFormat)(section->param >> 8);
+			contents->gradientLargest = prefix.largest;
+			contents->gradients = (const unsigned int *)(payload + sizeof(GradientPrefix));
+			contents->gradientSeconds = section->seconds;
+			return true;
+		}
+
+		case SECTION_PYRAMID:
+			if (section->param > PYRAMID_GAUSSIAN) return false;
+			contents->pyramid.clear();
+			if (!readPyramid(payload, section->size, desc, &contents->pyramid)) {
+				contents->pyramid.clear();
+				return false;
+			}
+			contents->pyramidFilter = (PyramidFilter)section->param;
+			contents->pyramidSeconds = section->seconds;
+			return true;
+	}
+
+	// sections of later versions are skipped
+	return true;
+}
+
+static const char *checkHeader(const CacheHeader *header, const VolumeDesc *desc, unsigned long long hash)
+{
+	if (memcmp(header->magic, "VOLCACHE", 8) != 0) return "not a volume cache";
+	if (header->version != CACHE_VERSION) return "written by another version";
+	if (header->byteOrder != CACHE_BYTE_ORDER) return "written on a machine of the other byte order";
+	if (header->hash != hash) return "the voxels changed";
+	if (header->dims[0] != desc->dims[0] || header->dims[1] != desc->dims[1] || header->dims[2] != desc->dims[2] ||
+		header->type != (int)desc->type || header->bigEndian != (int)desc->bigEndian) {
+		return "the volume is described differently";
+	}
+	return NULL;
+}
+
+bool openVolumeCache(const char *path, const VolumeDesc *desc, unsigned long long hash, VolumeCache *cache)
+{
+	memset(&cache->file, 0, sizeof(cache->file));
+	cache->file.fd = -1;
+	clearVolumeCacheContents(&cache->contents);
+
+	size_t size;
+	if (!fileSizeOf(path, &size)) return false;
+	if (size < sizeof(CacheHeader)) {
+		printf("Cache %s is stale (truncated), rebuilding it\n", path);
+		return false;
+	}
+	if (!openVolumeSource(path, 0, size, &cache->file)) return false;
+
+	CacheHeader header;
+	memcpy(&header, cache->file.data, sizeof(header));
+	const char *reason = checkHeader(&header, desc, hash);
+	if (reason == NULL && (size - sizeof(CacheHeader)) / sizeof(CacheSection) < header.sectionCount) reason = "truncated";
+	if (reason) {
+		printf("Cache %s is stale (%s), rebuilding it\n", path, reason);
+		closeVolumeCache(cache);
+		return false;
+	}
+	cache->contents.loadSeconds = header.loadSeconds;
+
+	for (unsigned int s = 0; s < header.sectionCount; s++) {
+		CacheSection section;
+		memcpy(&section, cache->file.data + sizeof(CacheHeader) + s * sizeof(CacheSection), sizeof(section));
+		bool inside = section.offset % CACHE_ALIGNMENT == 0 && section.offset <= size && section.size <= size - section.offset;
+		if (!inside || !readSection(&section, cache->file.data + section.offset, desc, &cache->contents)) {
+			printf("Cache %s: the %s section is damaged, rebuilding it\n", path, sectionName(section.tag));
+		}
+	}
+	return true;
+}
+
+void closeVolumeCache(VolumeCache *cache)
+{
+	closeVolumeSource(&cache->file);
+	clearVolumeCacheContents(&cache->contents);
+}
+
+
+//
+// Writing: the section table is laid out first, then every payload is
+// written at its aligned offset
+//
+struct PendingSection
+{
+	CacheSection section;
+	std::vector<unsigned char> prefix;		// written at the start of the payload
+	std::vector<const void *> pieces;		// the data after it
+	std::vector<size_t> pieceOffsets;		// from the start of the payload
+	std::vector<size_t> pieceBytes;
+};
+
+static size_t alignUp(size_t offset)
+{
+	return (offset + CACHE_ALIGNMENT - 1) / CACHE_ALIGNMENT * CACHE_ALIGNMENT;
+}
+
+static PendingSection pendingSection(unsigned int tag, unsigned int param, double seconds, const void *prefix, size_t prefixBytes)
+{
+	PendingSection pending;
+	pending.section.tag = tag;
+	pending.section.param = param;
+	pending.section.offset = 0;
+	pending.section.size = prefixBytes;
+	pending.section.seconds = seconds;
+	pending.prefix.assign((const unsigned char *)prefix, (const unsigned char *)prefix + prefixBytes);
+	return pending;
+}
+
+static void addPiece(PendingSection *pending, const void *data, size_t bytes, size_t offset)
+{
+	pending->pieces.push_back(data);
+	pending->pieceOffsets.push_back(offset);
+	pending->pieceBytes.push_back(bytes);
+	pending->section.size = offset + bytes;
+}
+
+static bool writeZeros(FILE *f, size_t count)
+{
+	static const unsigned char zeros[CACHE_ALIGNMENT] = { 0 };
+	while (count > 0) {
+		size_t n = std::min(count, (size_t)CACHE_ALIGNMENT);
+		if (fwrite(zeros, 1, n, f) != n) return false;
+		count -= n;
+	}
+	return true;
+}
+
+static void collectSections(const VolumeDesc *desc, const VolumeCacheContents *contents, std::vector<PendingSection> *sections)
+{
+	if (contents->histogram) {
+		PendingSection pending = pendingSection(SECTION_HISTOGRAM, 0, contents->histogramSeconds, NULL, 0);
+		addPiece(&pending, contents->histogram, 256 * sizeof(uint64_t), 0);
+		sections->push_back(pending);
+	}
+
+	if (contents->brickMinMax) {
+		BrickPrefix prefix;
+		memset(&prefix, 0, sizeof(prefix));
+		memcpy(prefix.dims, contents->brickDims, sizeof(prefix.dims));
+		PendingSection pending = pendingSection(SECTION_BRICKS, 0, contents->brickSeconds, &prefix, sizeof(prefix));
+		addPiece(&pending, contents->brickMinMax, voxelCount(contents->brickDims) * 2, sizeof(prefix));
+		sections->push_back(pending);
+	}
+
+	if (contents->gradients) {
+		GradientPrefix prefix;
+		memset(&prefix, 0, sizeof(prefix));
+		prefix.largest = contents->gradientLargest;
+		PendingSection pending = pendingSection(SECTION_GRADIENTS, contents->gradientFilter | (contents->gradientFormat << 8),
+			contents->gradientSeconds, &prefix, sizeof(prefix));
+		addPiece(&pending, contents->gradients, voxelCount(desc->dims) * 4, sizeof(prefix));
+		sections->push_back(pending);
+	}
+
+	if (!contents->pyramid.empty()) {
+		PyramidPrefix prefix;
+		memset(&prefix, 0, sizeof(prefix));
+		prefix.count = (unsigned int)contents->pyramid.size();
+		std::vector<unsigned char> table(sizeof(PyramidPrefix) + prefix.count * sizeof(PyramidLevelEntry));
+		memcpy(table.data(), &prefix, sizeof(prefix));
+		PendingSection pending = pendingSection(SECTION_PYRAMID, contents->pyramidFilter, contents->pyramidSeconds, NULL, 0);
+
+		size_t offset = alignUp(table.size());
+		for (unsigned int l = 0; l < prefix.count; l++) {
+			const CachedLevel *level = &contents->pyramid[l];
+			PyramidLevelEntry entry;
+			memset(&entry, 0, sizeof(entry));
+			memcpy(entry.dims, level->dims, sizeof(entry.dims));
+			entry.offset = offset;
+			memcpy(table.data() + sizeof(PyramidPrefix) + l * sizeof(PyramidLevelEntry), &entry, sizeof(entry));
+
+			size_t bytes = voxelCount(level->dims) * levelVoxelSize(desc->type);
+			addPiece(&pending, level->voxels, bytes, offset);
+			offset = alignUp(offset + bytes);
+		}
+		pending.prefix = table;
+		sections->push_back(pending);
+	}
+}
+
+bool writeVolumeCache(const char *path, const VolumeDesc *desc, unsigned long long hash,
+	const VolumeCacheContents *contents, VolumeCache *previous, size_t *bytes)
+{
+	std::vector<PendingSection> sections;
+	collectSections(desc, contents, &sections);
+
+	CacheHeader header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, "VOLCACHE", 8);
+	header.version = CACHE_VERSION;
+	header.byteOrder = CACHE_BYTE_ORDER;
+	header.hash = hash;
+	memcpy(header.dims, desc->dims, sizeof(header.dims));
+	header.type = desc->type;
+	header.bigEndian = desc->bigEndian;
+	header.sectionCount = (unsigned int)sections.size();
+	header.loadSeconds = contents->loadSeconds;
+
+	size_t offset = alignUp(sizeof(CacheHeader) + sections.size() * sizeof(CacheSection));
+	for (size_t s = 0; s < sections.size(); s++) {
+		sections[s].section.offset = offset;
+		offset = alignUp(offset + sections[s].section.size);
+	}
+
+	char temporary[1100];
+	snprintf(temporary, sizeof(temporary), "%s.tmp", path);
+	FILE *f = fopen(temporary, "wb");
+	if (f == NULL) {
+		printf("Cannot write the cache %s\n", temporary);
+		return false;
+	}
+
+	bool ok = fwrite(&header, sizeof(header), 1, f) == 1;
+	for (size_t s = 0; s < sections.size() && ok; s++) {
+		ok = fwrite(&sections[s].section, sizeof(CacheSection), 1, f) == 1;
+	}
+	size_t position = sizeof(CacheHeader) + sections.size() * sizeof(CacheSection);
+	for (size_t s = 0; s < sections.size() && ok; s++) {
+		const PendingSection *pending = &sections[s];
+		size_t start = (size_t)pending->section.offset;
+		ok = writeZeros(f, start - position) && fwrite(pending->prefix.data(), 1, pending->prefix.size(), f) == pending->prefix.size();
+		position = start + pending->prefix.size();
+		for (size_t p = 0; p < pending->pieces.size() && ok; p++) {
+			start = (size_t)pending->section.offset + pending->pieceOffsets[p];
+			ok = writeZeros(f, start - position) && fwrite(pending->pieces[p], 1, pending->pieceBytes[p], f) == pending->pieceBytes[p];
+			position = start + pending->pieceBytes[p];
+		}
+	}
+	ok = fclose(f) == 0 && ok;
+	if (!ok) {
+		printf("Cannot write the cache %s\n", temporary);
+		remove(temporary);
+		return false;
+	}
+
+	// the new file replaces the one previous maps
+	if (previous) closeVolumeCache(previous);
+#ifdef _WIN32
+	remove(path);
+#endif
+	if (rename(temporary, path) != 0) {
+		printf("Cannot replace the cache %s\n", path);
+		remove(temporary);
+		return false;
+	}
+
+	*bytes = position;
+	return true;
+}
@@ -0,0 +1,98 @@
+// volumecache.h: sidecar cache of the preprocessing results of a volume
+//
+// The histogram, the min/max brick grid, the gradient volume and the pyramid
+// depend only on the voxels (and the filters they were built with), so they
+// are written once to a cache file and memory-mapped on later loads. The
+// file lives next to the voxel file (name.raw.cache) or, with a cache
+// directory, is named after the content hash, so copies of a dataset share
+// one entry there.
+//
+// A cache belongs to a volume if its 64-bit content hash, dimensions, voxel
+// type and byte order match. The hash runs over all voxel bytes on all
+// hardware threads in fixed-size chunks, so it does not depend on the thread
+// count. Every part is optional and carries the filter it was built with; a
+// part built with other settings is rebuilt and the file rewritten, keeping
+// the parts this load did not need.
+//
+// The file is written in host byte order: a header, a table of sections and
+// the section payloads, each starting on a CACHE_ALIGNMENT boundary so that
+// the mapped texels can be handed to GL as they are. It is written to a
+// temporary file first and renamed, so an interrupted write never leaves a
+// truncated cache behind.
+//
+//////////////////////////////////////////////////////////////////////
+
+#ifndef VOLUMECACHE_H
+#define VOLUMECACHE_H
+
+#include <stdint.h>
+
+#include <vector>
+
+#include "volumefile.h"
+#include "gradient.h"
+#include "pyramid.h"
+
+#define CACHE_ALIGNMENT 64		// bytes, alignment of every payload in the file
+
+struct CachedLevel
+{
+	int dims[3];
+	const unsigned char *voxels;	// 8-bit, unsigned 16-bit or float, as uploaded
+};
+
+// The parts of a cache. Each is absent while its pointer is NULL (pyramid:
+// empty); the pointers point into the mapping of an open cache, or to the
+// caller's data when writing. The seconds are what computing the part took
+// when it was last built.
+struct VolumeCacheContents
+{
+	const uint64_t *histogram;				// 256 bins
+	double histogramSeconds;
+
+	int brickDims[3];
+	const unsigned char *brickMinMax;		// min, max per brick as in BrickGrid
+	double brickSeconds;
+
+	GradientFilter gradientFilter;
+	GradientFormat gradientFormat;
+	float gradientLargest;					// as returned by computeGradientVolume
+	const unsigned int *gradients;			// one packed texel per voxel
+	double gradientSeconds;
+
+	PyramidFilter pyramidFilter;
+	std::vector<CachedLevel> pyramid;		// levels 1 and up
+	double pyramidSeconds;
+
+	double loadSeconds;						// load3Dfile time of the load that wrote the file
+};
+
+struct VolumeCache
+{
+	VolumeSource file;						// mapping of the cache file
+	VolumeCacheContents contents;
+};
+
+void clearVolumeCacheContents(VolumeCacheContents *contents);
+
+// Content hash of size bytes of voxels.
+unsigned long long hashVolume(const unsigned char *data, size_t size);
+
+// The cache file of a volume: next to its voxel file if directory is NULL,
+// otherwise named after the hash inside directory.
+void volumeCachePath(const char *directory, const VolumeDesc *desc, unsigned long long hash, char *path, size_t pathSize);
+
+// Maps the cache file at path if it belongs to the volume. A missing file
+// returns false quietly; a stale or damaged one prints why. The valid parts
+// are in cache->contents either way (all absent on false).
+bool openVolumeCache(const char *path, const VolumeDesc *desc, unsigned long long hash, VolumeCache *cache);
+void closeVolumeCache(VolumeCache *cache);
+
+// Writes the present parts of contents to path. previous (may be NULL),
+// which contents may point into, is closed before the new file replaces the
+// old one. Returns false (and prints the reason) if the file cannot be
+// written; *bytes is the file size otherwise.
+bool writeVolumeCache(const char *path, const VolumeDesc *desc, unsigned long long hash,
+	const VolumeCacheContents *contents, VolumeCache *previous, size_t *bytes);
+
+#endif
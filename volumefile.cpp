@@ -0,0 +1,509 @@
+// volumefile.cpp
+//
+// Volume descriptors and memory-mapped volume files with a buffered fallback
+//
+//////////////////////////////////////////////////////////////////////
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <math.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#endif
+
+#include "volumefile.h"
+#include "compressedvolume.h"
+
+
+//
+// Volume descriptors
+//
+bool parseVoxelType(const char *name, VoxelType *type)
+{
+	if (!strcmp(name, "uint8") || !strcmp(name, "uchar") || !strcmp(name, "unsigned char") || !strcmp(name, "uint8_t") ||
+		!strcmp(name, "MET_UCHAR")) {
+		*type = VOXEL_UINT8;
+	}
+	else if (!strcmp(name, "uint16") || !strcmp(name, "ushort") || !strcmp(name, "unsigned short") || !strcmp(name, "uint16_t") ||
+		!strcmp(name, "unsigned short int") || !strcmp(name, "MET_USHORT")) {
+		*type = VOXEL_UINT16;
+	}
+	else if (!strcmp(name, "int16") || !strcmp(name, "short") || !strcmp(name, "signed short") || !strcmp(name, "int16_t") ||
+		!strcmp(name, "short int") || !strcmp(name, "MET_SHORT")) {
+		*type = VOXEL_INT16;
+	}
+	else if (!strcmp(name, "float") || !strcmp(name, "float32") || !strcmp(name, "MET_FLOAT")) {
+		*type = VOXEL_FLOAT32;
+	}
+	else {
+		return false;
+	}
+	return true;
+}
+
+const char *voxelTypeName(VoxelType type)
+{
+	switch (type) {
+		case VOXEL_UINT8: return "uint8";
+		case VOXEL_UINT16: return "uint16";
+		case VOXEL_INT16: return "int16";
+		case VOXEL_FLOAT32: return "float";
+	}
+	return "?";
+}
+
+int voxelSize(VoxelType type)
+{
+	switch (type) {
+		case VOXEL_UINT8: return 1;
+		case VOXEL_UINT16: return 2;
+		case VOXEL_INT16: return 2;
+		case VOXEL_FLOAT32: return 4;
+	}
+	return 1;
+}
+
+size_t volumeBytes(const VolumeDesc *desc)
+{
+	return (size_t)desc->dims[0] * desc->dims[1] * desc->dims[2] * voxelSize(desc->type);
+}
+
+bool hostIsBigEndian()
+{
+	const unsigned short one = 1;
+	return *(const unsigned char *)&one == 0;
+}
+
+bool needsByteSwap(const VolumeDesc *desc)
+{
+	return voxelSize(desc->type) > 1 && desc->bigEndian != hostIsBigEndian();
+}
+
+void swapVoxels(unsigned char *p, size_t count, int size)
+{
+	for (size_t i = 0; i < count; i++, p += size) {
+		for (int a = 0, b = size - 1; a < b; a++, b--) {
+			unsigned char t = p[a];
+			p[a] = p[b];
+			p[b] = t;
+		}
+	}
+}
+
+bool fileSizeOf(const char *path, size_t *size)
+{
+#ifdef _WIN32
+	struct __stat64 st;
+	if (_stat64(path, &st) != 0) return false;
+#else
+	struct stat st;
+	if (stat(path, &st) != 0) return false;
+#endif
+	*size = (size_t)st.st_size;
+	return true;
+}
+
+// strips leading and trailing white space in place
+static char *trim(char *s)
+{
+	while (isspace((unsigned char)*s)) s++;
+	char *end = s + strlen(s);
+	while (end > s && isspace((unsigned char)end[-1])) *--end = '\0';
+	return s;
+}
+
+static bool isTrue(const char *value)
+{
+	return !strcmp(value, "True") || !strcmp(value, "true") || !strcmp(value, "1");
+}
+
+// whether the file name ends in extension (".mhd"), in any case
+static bool hasExtension(const char *filename, const char *extension)
+{
+	size_t length = strlen(filename), extensionLength = strlen(extension);
+	if (length < extensionLength) return false;
+	const char *end = filename + length - extensionLength;
+	for (size_t i = 0; i < extensionLength; i++) {
+		if (tolower((unsigned char)end[i]) != extension[i]) return false;
+	}
+	return true;
+}
+
+// resolves a data file name relative to the directory of the header
+static void siblingPath(const char *header, const char *name, char *path, size_t pathSize)
+{
+	const char *slash = strrchr(header, '/');
+	const char *backslash = strrchr(header, '\\');
+	if (backslash > slash) slash = backslash;
+
+	if (slash == NULL || name[0] == '/' || name[0] == '\\' || (name[0] && name[1] == ':')) {
+		snprintf(path, pathSize, "%s", name);
+	}
+	else {
+		snprintf(path, pathSize, "%.*s%s", (int)(slash - header + 1), header, name);
+	}
+}
+
+//
+// NRRD: "NRRD000x" magic, "key: value" lines, data after the first blank
+// line unless a detached "data file" is given. Only raw encoding is read.
+//
+static bool parseNrrd(const char *filename, FILE *f, VolumeDesc *desc)
+{
+	char line[1024];
+	bool detached = false;
+	size_t byteSkip = 0;
+
+	while (fgets(line, sizeof(line), f)) {
+		if (line[0] == '#') continue;
+		char *text = trim(line);
+		if (text[0] == '\0') break;	// end of header
+
+		char *colon = strchr(text, ':');
+		if (colon == NULL) continue;
+		*colon = '\0';
+		char *key = trim(text);
+		char *value = trim(colon + (colon[1] == '=' ? 2 : 1));
+
+		if (!strcmp(key, "type")) {
+			if (!parseVoxelType(value, &desc->type)) {
+				printf("%s: unsupported NRRD type \"%s\"\n", filename, value);
+				return false;
+			}
+		}
+		else if (!strcmp(key, "dimension")) {
+			if (atoi(value) != 3) {
+				printf("%s: only 3D NRRD files are supported\n", filename);
+				return false;
+			}
+		}
+		else if (!strcmp(key, "sizes")) {
+			sscanf(value, "%d %d %d", &desc->dims[0], &desc->dims[1], &desc->dims[2]);
+		}
+		else if (!strcmp(key, "spacings")) {
+			sscanf(value, "%f %f %f", &desc->spacing[0], &desc->spacing[1], &desc->spacing[2]);
+		}
+		else if (!strcmp(key, "space directions")) {
+			float v[3][3];
+			if (sscanf(value, " (%f,%f,%f) (%f,%f,%f) (%f,%f,%f)", &v[0][0], &v[0][1], &v[0][2],
+				&v[1][0], &v[1][1], &v[1][2], &v[2][0], &v[2][1], &v[2][2]) == 9) {
+				for (int i = 0; i < 3; i++) {
+					desc->spacing[i] = sqrtf(v[i][0] * v[i][0] + v[i][1] * v[i][1] + v[i][2] * v[i][2]);
+				}
+			}
+		}
+		else if (!strcmp(key, "endian")) {
+			desc->bigEndian = !strcmp(value, "big");
+		}
+		else if (!strcmp(key, "encoding")) {
+			if (strcmp(value, "raw")) {
+				printf("%s: unsupported NRRD encoding \"%s\"\n", filename, value);
+				return false;
+			}
+		}
+		else if (!strcmp(key, "byte skip")) {
+			byteSkip = (size_t)atol(value);
+		}
+		else if (!strcmp(key, "data file") || !strcmp(key, "datafile")) {
+			siblingPath(filename, value, desc->dataFile, sizeof(desc->dataFile));
+			detached = true;
+		}
+	}
+
+	if (detached) desc->dataOffset = byteSkip;
+	else desc->dataOffset = (size_t)ftell(f) + byteSkip;
+	return true;
+}
+
+//
+// MetaImage: "Key = Value" lines, ElementDataFile comes last. LOCAL means
+// the voxels follow the header in the same file (.mha).
+//
+static bool parseMetaImage(const char *filename, FILE *f, VolumeDesc *desc)
+{
+	char line[1024];
+	long headerSize = 0;
+
+	while (fgets(line, sizeof(line), f)) {
+		char *equal = strchr(line, '=');
+		if (equal == NULL) continue;
+		*equal = '\0';
+		char *key = trim(line);
+		char *value = trim(equal + 1);
+
+		if (!strcmp(key, "NDims")) {
+			if (atoi(value) != 3) {
+				printf("%s: only 3D MetaImage files are supported\n", filename);
+				return false;
+			}
+		}
+		else if (!strcmp(key, "DimSize")) {
+			sscanf(value, "%d %d %d", &desc->dims[0], &desc->dims[1], &desc->dims[2]);
+		}
+		else if (!strcmp(key, "ElementSpacing")) {
+			sscanf(value, "%f %f %f", &desc->spacing[0], &desc->spacing[1], &desc->spacing[2]);
+		}
+		else if (!strcmp(key, "ElementType")) {
+			if (!parseVoxelType(value, &desc->type)) {
+				printf("%s: unsupported MetaImage element type \"%s\"\n", filename, value);
+				return false;
+			}
+		}
+		else if (!strcmp(key, "ElementByteOrderMSB") || !strcmp(key, "BinaryDataByteOrderMSB")) {
+			desc->bigEndian = isTrue(value);
+		}
+		else if (!strcmp(key, "CompressedData")) {
+			if (isTrue(value)) {
+				printf("%s: compressed MetaImage data is not supported\n", filename);
+				return false;
+			}
+		}
+		else if (!strcmp(key, "HeaderSize")) {
+			headerSize = atol(value);
+		}
+		else if (!strcmp(key, "ElementDataFile")) {
+			if (!strcmp(value, "LOCAL")) {
+				desc->dataOffset = (size_t)ftell(f);
+			}
+			else {
+				siblingPath(filename, value, desc->dataFile, sizeof(desc->dataFile));
+				desc->dataOffset = 0;
+			}
+			break;
+		}
+	}
+
+	// HeaderSize = -1: the voxels are the last bytes of the data file
+	if (headerSize > 0) desc->dataOffset = (size_t)headerSize;
+	else if (headerSize < 0) {
+		size_t bytes;
+		desc->dataOffset = fileSizeOf(desc->dataFile, &bytes) && bytes > volumeBytes(desc) ? bytes - volumeBytes(desc) : 0;
+	}
+	return true;
+}
+
+//
+// name_W_H_D.raw: the last three numbers separated by '_' are the dimensions
+//
+static bool parseRawName(const char *filename, VolumeDesc *desc)
+{
+	const char *name = filename;
+	for (const char *c = filename; *c; c++) {
+		if (*c == '/' || *c == '\\') name = c + 1;
+	}
+
+	int dims[3];
+	int found = 0;
+	const char *c = name;
+	while ((c = strchr(c, '_')) != NULL) {
+		c++;
+		int w, h, d, n = 0;
+		if (sscanf(c, "%d_%d_%d%n", &w, &h, &d, &n) == 3 && (c[n] == '.' || c[n] == '_' || c[n] == '\0')) {
+			dims[0] = w, dims[1] = h, dims[2] = d;
+			found = 1;
+		}
+	}
+	if (!found) return false;
+
+	desc->dims[0] = dims[0];
+	desc->dims[1] = dims[1];
+	desc->dims[2] = dims[2];
+	return true;
+}
+
+bool parseVolumeDesc(const char *filename, VolumeDesc *desc)
+{
+	memset(desc, 0, sizeof(VolumeDesc));
+	snprintf(desc->dataFile, sizeof(desc->dataFile), "%s", filename);
+	desc->spacing[0] = desc->spacing[1] = desc->spacing[2] = 1;
+	desc->type = VOXEL_UINT8;
+
+	char magic[9] = { 0 };
+	FILE *f = fopen(filename, "rb");
+	if (f != NULL) {
+		size_t count = fread(magic, 1, 8, f);
+		magic[count] = '\0';
+		rewind(f);
+	}
+
+	bool ok;
+	if (f != NULL && strncmp(magic, "NRRD000", 7) == 0) {
+		ok = parseNrrd(filename, f, desc);
+	}
+	else if (f != NULL && strcmp(magic, "CVOLUME") == 0) {
+		ok = readCompressedVolumeDesc(filename, desc);
+	}
+	else if (f != NULL && (hasExtension(filename, ".mhd") || hasExtension(filename, ".mha"))) {
+		ok = parseMetaImage(filename, f, desc);
+	}
+	else {
+		ok = parseRawName(filename, desc);
+	}
+	if (f != NULL) fclose(f);
+
+	return ok;
+}
+
+
+//
+// Volume sources
+//
+static bool mapVolumeFile(const char *filename, size_t offset, size_t size, VolumeSource *src)
+{
+#ifdef _WIN32
+	HANDLE file = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING,
+		FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+	if (file == INVALID_HANDLE_VALUE) return false;
+
+	LARGE_INTEGER fileSize;
+	if (!GetFileSizeEx(file, &fileSize) || (unsigned long long)fileSize.QuadPart < offset + size) {
+		CloseHandle(file);
+		return false;
+	}
+
+	HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+	if (mapping == NULL) {
+		CloseHandle(file);
+		return false;
+	}
+
+	// views start on an allocation granularity boundary
+	SYSTEM_INFO info;
+	GetSystemInfo(&info);
+	size_t start = offset - offset % info.dwAllocationGranularity;
+	size_t length = offset - start + size;
+
+	void *view = MapViewOfFile(mapping, FILE_MAP_READ, (DWORD)((unsigned long long)start >> 32), (DWORD)start, length);
+	if (view == NULL) {
+		CloseHandle(mapping);
+		CloseHandle(file);
+		return false;
+	}
+
+	src->file = file;
+	src->mapping = mapping;
+	src->view = view;
+	src->viewSize = length;
+	src->data = (const unsigned char *)view + (offset - start);
+#else
+	int fd = open(filename, O_RDONLY);
+	if (fd < 0) return false;
+
+	struct stat st;
+	if (fstat(fd, &st) != 0 || (size_t)st.st_size < offset + size) {
+		close(fd);
+		return false;
+	}
+
+	// mappings start on a page boundary
+	size_t start = offset - offset % (size_t)sysconf(_SC_PAGESIZE);
+	size_t length = offset - start + size;
+
+	void *view = mmap(NULL, length, PROT_READ, MAP_PRIVATE, fd, (off_t)start);
+	if (view == MAP_FAILED) {
+		close(fd);
+		return false;
+	}
+
+	// The volume is consumed front to back exactly once during loading.
+	// The hints are advisory, so failures are ignored.
+	madvise(view, length, MADV_SEQUENTIAL);
+	madvise(view, length, MADV_WILLNEED);
+#ifdef MADV_HUGEPAGE
+	madvise(view, length, MADV_HUGEPAGE);
+#endif
+
+	src->fd = fd;
+	src->view = view;
+	src->viewSize = length;
+	src->data = (const unsigned char *)view + (offset - start);
+#endif
+
+	src->size = size;
+	src->mapped = true;
+	return true;
+}
+
+static bool readVolumeFile(const char *filename, size_t offset, size_t size, VolumeSource *src)
+{
+	FILE *f = fopen(filename, "rb");
+	if (f == NULL) return false;
+	if (offset > 0 && fseek(f, (long)offset, SEEK_SET) != 0) {
+		fclose(f);
+		return false;
+	}
+
+	unsigned char *buffer = (unsigned char *)malloc(size);
+	if (buffer == NULL) {
+		fclose(f);
+		return false;
+	}
+
+	size_t count = fread(buffer, 1, size, f);
+	fclose(f);
+	if (count != size) {
+		free(buffer);
+		return false;
+	}
+
+	src->data = buffer;
+	src->size = size;
+	src->mapped = false;
+	return true;
+}
+
+bool openVolumeSource(const char *filename, size_t offset, size_t size, VolumeSource *src)
+{
+	memset(src, 0, sizeof(VolumeSource));
+	src->fd = -1;
+
+	if (size == 0) {
+		printf("Cannot open %s: empty volume\n", filename);
+		return false;
+	}
+
+	if (mapVolumeFile(filename, offset, size, src)) return true;
+	if (readVolumeFile(filename, offset, size, src)) return true;
+
+	printf("Cannot read %lu bytes at offset %lu from %s\n", (unsigned long)size, (unsigned long)offset, filename);
+	return false;
+}
+
+void closeVolumeSource(VolumeSource *src)
+{
+	if (src->data == NULL) return;
+
+	if (src->mapped) {
+#ifdef _WIN32
+		UnmapViewOfFile(src->view);
+		CloseHandle((HANDLE)src->mapping);
+		CloseHandle((HANDLE)src->file);
+#else
+		munmap(src->view, src->viewSize);
+		close(src->fd);
+#endif
+	}
+	else {
+		free((void *)src->data);
+	}
+
+	memset(src, 0, sizeof(VolumeSource));
+	src->fd = -1;
+}
+
+bool openVolumeData(const VolumeDesc *desc, VolumeSource *src)
+{
+	if (desc->compressed) return decompressVolume(desc, src);
+	return openVolumeSource(desc->dataFile, desc->dataOffset, volumeBytes(desc), src);
+}
@@ -0,0 +1,117 @@
+// volumefile.h: describing and reading volume files
+//
+// A VolumeDesc says where the voxels of a dataset are and how they are laid
+// out. It is parsed from a NRRD (.nrrd/.nhdr) or MetaImage (.mhd/.mha)
+// header, from the header of a compressed .cvol file, or from the
+// name_W_H_D.raw convention of the bundled datasets, and can be overridden
+// from the command line.
+//
+// The voxel file is memory-mapped whenever the platform allows it, so the
+// texture upload and the histogram pass read the voxels straight from the
+// page cache instead of from a private heap copy. If mapping fails the data
+// is read into a heap buffer with fread, and callers see the same interface.
+//
+//////////////////////////////////////////////////////////////////////
+
+#ifndef VOLUMEFILE_H
+#define VOLUMEFILE_H
+
+#include <stddef.h>
+#include <string.h>
+
+enum VoxelType
+{
+	VOXEL_UINT8,
+	VOXEL_UINT16,
+	VOXEL_INT16,		// stored as uint16 with a bias of 32768 once loaded
+	VOXEL_FLOAT32		// expected to be normalized to [0,1]
+};
+
+struct VolumeDesc
+{
+	char dataFile[1024];	// file holding the voxels
+	size_t dataOffset;		// bytes to skip at the start of dataFile
+	int dims[3];			// W, H, D
+	float spacing[3];		// voxel size
+	VoxelType type;
+	bool bigEndian;			// byte order of the voxels in dataFile
+	bool compressed;		// dataFile holds compressed bricks (see compressedvolume.h)
+};
+
+// Fills desc from the header or the file name of filename. Returns false if
+// the layout cannot be determined; header errors print the reason.
+bool parseVolumeDesc(const char *filename, VolumeDesc *desc);
+
+// Parses "uint8", "uint16", "int16" or "float".
+bool parseVoxelType(const char *name, VoxelType *type);
+const char *voxelTypeName(VoxelType type);
+int voxelSize(VoxelType type);
+size_t volumeBytes(const VolumeDesc *desc);
+
+// True if the voxels must be byte-swapped to match this machine.
+bool needsByteSwap(const VolumeDesc *desc);
+bool hostIsBigEndian();
+
+// Reverses the bytes of each of count voxels of size bytes at p.
+void swapVoxels(unsigned char *p, size_t count, int size);
+
+// Size of the file at path in bytes; false if it cannot be found.
+bool fileSizeOf(const char *path, size_t *size);
+
+// The voxel at p normalized to [0,1] like the R8/R16/R16F texture the
+// shader samples; swap: its bytes are in the other byte order.
+template <VoxelType type>
+inline float decodeVoxel(const unsigned char *p, bool swap)
+{
+	if (type == VOXEL_UINT8) {
+		return *p / 255.0f;
+	}
+	else if (type == VOXEL_FLOAT32) {
+		unsigned int bits;
+		memcpy(&bits, p, 4);
+		if (swap) bits = (bits >> 24) | ((bits >> 8) & 0xff00) | ((bits << 8) & 0xff0000) | (bits << 24);
+		float v;
+		memcpy(&v, &bits, 4);
+		return v;
+	}
+	else {
+		unsigned int v = swap ? (p[0] << 8) | p[1] : p[0] | (p[1] << 8);
+		if (type == VOXEL_INT16) v ^= 0x8000;
+		return v / 65535.0f;
+	}
+}
+
+inline float decodeVoxel(VoxelType type, const unsigned char *p, bool swap)
+{
+	switch (type) {
+	case VOXEL_UINT8: return decodeVoxel<VOXEL_UINT8>(p, swap);
+	case VOXEL_UINT16: return decodeVoxel<VOXEL_UINT16>(p, swap);
+	case VOXEL_INT16: return decodeVoxel<VOXEL_INT16>(p, swap);
+	default: return decodeVoxel<VOXEL_FLOAT32>(p, swap);
+	}
+}
+
+struct VolumeSource
+{
+	const unsigned char *data;	// first voxel
+	size_t size;				// number of bytes available at data
+	bool mapped;				// true: file mapping, false: heap buffer
+
+	// platform specific handles
+	void *file;
+	void *mapping;
+	void *view;
+	size_t viewSize;
+	int fd;
+};
+
+// Makes size bytes of filename, starting at offset, available in src->data.
+// Returns false (and prints the reason) if the file is missing or too short.
+bool openVolumeSource(const char *filename, size_t offset, size_t size, VolumeSource *src);
+void closeVolumeSource(VolumeSource *src);
+
+// Makes the voxels of desc available in src->data: the file mapping, or the
+// decompressed bricks of a compressed volume.
+bool openVolumeData(const VolumeDesc *desc, VolumeSource *src);
+
+#endif
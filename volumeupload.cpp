@@ -0,0 +1,229 @@
+// volumeupload.cpp
+//
+// Slab-by-slab 3D texture upload through a ring of pixel-unpack buffers
+//
+//////////////////////////////////////////////////////////////////////
+
+#include <stdio.h>
+#include <string.h>
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <vector>
+
+#include <GL/glew.h>
+
+#include "volumeupload.h"
+#include "histogram.h"
+
+// number of pixel-unpack buffers in flight
+#define RING_SIZE 3
+
+// target number of bytes per slab
+#define SLAB_BYTES (4 << 20)
+
+
+struct SlabRing
+{
+	std::mutex lock;
+	std::condition_variable signal;
+
+	unsigned char *target[RING_SIZE];	// mapped buffer handed to the reader, NULL if not posted
+	int posted[RING_SIZE];				// slab index the buffer was posted for
+	int filled;							// number of slabs the reader has finished
+};
+
+
+void volumeTextureFormat(VoxelType type, GLenum *internalFormat, GLenum *format, GLenum *pixelType)
+{
+	*format = GL_RED;
+	*internalFormat = GL_R8;
+	*pixelType = GL_UNSIGNED_BYTE;
+	switch (type) {
+		case VOXEL_UINT8:
+			break;
+		case VOXEL_UINT16:
+		case VOXEL_INT16:
+			*internalFormat = GL_R16;
+			*pixelType = GL_UNSIGNED_SHORT;
+			break;
+		case VOXEL_FLOAT32:
+			*internalFormat = GL_R16F;
+			*pixelType = GL_FLOAT;
+			break;
+	}
+}
+
+void convertVoxels(const unsigned char *slab, size_t bytes, const VolumeDesc *desc, unsigned char *result)
+{
+	bool swap = needsByteSwap(desc);
+	int size = voxelSize(desc->type);
+
+	if (size == 2) {
+		unsigned short bias = desc->type == VOXEL_INT16 ? 0x8000 : 0;
+		const unsigned short *in = (const unsigned short *)slab;
+		unsigned short *out = (unsigned short *)result;
+		for (size_t i = 0; i < bytes / 2; i++) {
+			unsigned short v = swap ? (unsigned short)((in[i] >> 8) | (in[i] << 8)) : in[i];
+			out[i] = v ^ bias;
+		}
+	}
+	else if (size == 4) {
+		const unsigned int *in = (const unsigned int *)slab;
+		unsigned int *out = (unsigned int *)result;
+		for (size_t i = 0; i < bytes / 4; i++) {
+			unsigned int v = in[i];
+			out[i] = (v >> 24) | ((v >> 8) & 0xff00) | ((v << 8) & 0xff0000) | (v << 24);
+		}
+	}
+}
+
+//
+// Reader thread: copy each posted slab into its buffer and count its voxels
+// unless counts is NULL
+//
+static void readSlabs(const VolumeSource *src, const VolumeDesc *desc, size_t slabBytes, int slabCount, SlabRing *ring, uint64_t counts[256])
+{
+	bool convert = needsByteSwap(desc) || desc->type == VOXEL_INT16;
+	std::vector<unsigned char> staging(convert ? slabBytes : 0);
+
+	for (int s = 0; s < slabCount; s++) {
+		int slot = s % RING_SIZE;
+		unsigned char *target;
+		{
+			std::unique_lock<std::mutex> guard(ring->lock);
+			ring->signal.wait(guard, [&] { return ring->posted[slot] == s; });
+			target = ring->target[slot];
+		}
+
+		size_t offset = s * slabBytes;
+		size_t bytes = offset + slabBytes < src->size ? slabBytes : src->size - offset;
+		const unsigned char *slab = src->data + offset;
+
+		if (convert) {
+			convertVoxels(slab, bytes, desc, staging.data());
+			slab = staging.data();
+		}
+
+		if (target) memcpy(target, slab, bytes);
+		if (counts) accumulateHistogram(slab, bytes / voxelSize(desc->type), voxelSize(desc->type), 256, counts);
+
+		{
+			std::lock_guard<std::mutex> guard(ring->lock);
+			ring->filled = s + 1;
+		}
+		ring->signal.notify_all();
+	}
+}
+
+static void postSlab(SlabRing *ring, GLuint buffer, int s, size_t slabBytes)
+{
+	int slot = s % RING_SIZE;
+
+	// orphan the previous contents so mapping never waits for an upload in flight
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, buffer);
+	glBufferData(GL_PIXEL_UNPACK_BUFFER, slabBytes, NULL, GL_STREAM_DRAW);
+	unsigned char *target = (unsigned char *)glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, slabBytes,
+		GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+
+	{
+		std::lock_guard<std::mutex> guard(ring->lock);
+		ring->target[slot] = target;
+		ring->posted[slot] = s;
+	}
+	ring->signal.notify_all();
+}
+
+void uploadVolume(const VolumeSource *src, const VolumeDesc *desc, uint64_t counts[256])
+{
+	int w = desc->dims[0], h = desc->dims[1], d = desc->dims[2];
+	GLenum internalFormat, format, pixelType;
+	volumeTextureFormat(desc->type, &internalFormat, &format, &pixelType);
+
+	size_t sliceBytes = (size_t)w * h * voxelSize(desc->type);
+	bool convert = needsByteSwap(desc) || desc->type == VOXEL_INT16;
+	int slabDepth = (int)(SLAB_BYTES / sliceBytes);
+	if (slabDepth < 1) slabDepth = 1;
+	if (slabDepth > d) slabDepth = d;
+	size_t slabBytes = sliceBytes * slabDepth;
+	int slabCount = (d + slabDepth - 1) / slabDepth;
+
+	if (counts) memset(counts, 0, 256 * sizeof(uint64_t));
+
+	SlabRing ring;
+	for (int i = 0; i < RING_SIZE; i++) {
+		ring.target[i] = NULL;
+		ring.posted[i] = -1;
+	}
+	ring.filled = 0;
+
+	GLuint buffers[RING_SIZE];
+	glGenBuffers(RING_SIZE, buffers);
+
+	std::thread reader(readSlabs, src, desc, slabBytes, slabCount, &ring, counts);
+
+	for (int s = 0; s < RING_SIZE && s < slabCount; s++) {
+		postSlab(&ring, buffers[s], s, slabBytes);
+	}
+
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+	for (int s = 0; s < slabCount; s++) {
+		int slot = s % RING_SIZE;
+		{
+			std::unique_lock<std::mutex> guard(ring.lock);
+			ring.signal.wait(guard, [&] { return ring.filled > s; });
+		}
+
+		int z = s * slabDepth;
+		int depth = z + slabDepth < d ? slabDepth : d - z;
+
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, buffers[slot]);
+		if (ring.target[slot] && glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER)) {
+			glTexSubImage3D(GL_TEXTURE_3D, 0, 0, 0, z, w, h, depth, format, pixelType, (void *)0);
+		}
+		else {
+			// mapping failed or the buffer got corrupted: upload from the source directly
+			glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+			const unsigned char *slab = src->data + s * slabBytes;
+			std::vector<unsigned char> converted;
+			if (convert) {
+				converted.resize(depth * sliceBytes);
+				convertVoxels(slab, converted.size(), desc, converted.data());
+				slab = converted.data();
+			}
+			glTexSubImage3D(GL_TEXTURE_3D, 0, 0, 0, z, w, h, depth, format, pixelType, slab);
+		}
+
+		if (s + RING_SIZE < slabCount) {
+			postSlab(&ring, buffers[slot], s + RING_SIZE, slabBytes);
+		}
+	}
+
+	reader.join();
+
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+	glDeleteBuffers(RING_SIZE, buffers);
+}
+
+void histogramVolume(const VolumeSource *src, const VolumeDesc *desc, uint64_t counts[256])
+{
+	int w = desc->dims[0], h = desc->dims[1], d = desc->dims[2];
+	int size = voxelSize(desc->type);
+	if (!needsByteSwap(desc) && desc->type != VOXEL_INT16) {
+		computeHistogram(src->data, w, h, d, size, 256, counts);
+		return;
+	}
+
+	size_t sliceBytes = (size_t)w * h * size;
+	int slabDepth = (int)(SLAB_BYTES / sliceBytes);
+	if (slabDepth < 1) slabDepth = 1;
+	std::vector<unsigned char> staging(sliceBytes * slabDepth);
+
+	memset(counts, 0, 256 * sizeof(uint64_t));
+	for (int z = 0; z < d; z += slabDepth) {
+		int depth = z + slabDepth < d ? slabDepth : d - z;
+		convertVoxels(src->data + z * sliceBytes, depth * sliceBytes, desc, staging.data());
+		accumulateHistogram(staging.data(), depth * sliceBytes / size, size, 256, counts);
+	}
+}
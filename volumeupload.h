@@ -0,0 +1,38 @@
+// volumeupload.h: pipelined upload of a volume into a 3D texture
+//
+// A reader thread copies Z-slabs from the volume source into a ring of
+// pixel-unpack buffers and accumulates the histogram of each slab, while the
+// render thread hands the filled buffers to glTexSubImage3D. Reading,
+// histogramming and the transfer to the GPU therefore overlap instead of
+// running one after another.
+//
+//////////////////////////////////////////////////////////////////////
+
+#ifndef VOLUMEUPLOAD_H
+#define VOLUMEUPLOAD_H
+
+#include <stdint.h>
+
+#include <GL/glew.h>
+
+#include "volumefile.h"
+
+// Tightest texture format holding voxels of the given type without an 8-bit
+// round trip (R8, R16 or R16F), and the pixel format/type to upload them with.
+void volumeTextureFormat(VoxelType type, GLenum *internalFormat, GLenum *format, GLenum *pixelType);
+
+// Converts voxels in the byte order and int16 bias of desc to host order and
+// unsigned 16-bit values, as the texture expects them. result may be slab.
+void convertVoxels(const unsigned char *slab, size_t bytes, const VolumeDesc *desc, unsigned char *result);
+
+// Uploads the voxels of src, laid out as described by desc, into level 0 of
+// the 3D texture currently bound to GL_TEXTURE_3D, which must already have
+// storage for them. Byte order and int16 bias are fixed on the reader thread.
+// counts[256] receives the histogram over the normalized value range; NULL
+// skips it (the histogram came from the cache).
+void uploadVolume(const VolumeSource *src, const VolumeDesc *desc, uint64_t counts[256]);
+
+// The same histogram without uploading anything, for volumes that are paged in.
+void histogramVolume(const VolumeSource *src, const VolumeDesc *desc, uint64_t counts[256]);
+
+#endif